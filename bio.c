@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -17,6 +17,14 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Buffers are hashed by (dev, blockno) into NBUCKET chains, each
+// with its own lock, so lookups of different blocks don't contend.
+// A buffer's refcnt and chain links are protected by its bucket's
+// lock.  Misses take bcache.lock, which serializes changing a
+// buffer's identity, and pick a victim with a clock sweep over all
+// buffers: brelse sets b->used, the sweep clears it and recycles
+// the first unused buffer it finds with refcnt 0.
 
 #include "types.h"
 #include "defs.h"
@@ -25,34 +33,119 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "mmu.h"
 
-struct {
+#define NBUCKET 61
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;     // chain through hnext
+  uint hits;
+};
+
+struct {
+  struct spinlock lock; // held while recycling a buffer
+  struct bucket bucket[NBUCKET];
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+  // Ring of all buffers, through cnext; hand is the clock hand.
+  struct buf *hand;
+  int nbuf;
+  uint misses;
+  uint evictions;
+  uint readaheads;
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+// Allocate the buffers from whole pages, so the cache is not limited
+// by the kernel's static data.  Must come after kinit2().
 void
 binit(void)
 {
-  struct buf *b;
+  struct bucket *bk;
+  struct buf *b, *last;
+  char *page;
+  int i, n;
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < &bcache.bucket[NBUCKET]; bk++)
+    initlock(&bk->lock, "bcache.bucket");
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // Create the ring of buffers, all in bucket 0 as block 0 of
+  // device 0 is never read (ROOTDEV is 1).
+  last = 0;
+  while(bcache.nbuf < NBUF && (page = kalloc()) != 0){
+    memset(page, 0, PGSIZE);
+    n = PGSIZE / sizeof(struct buf);
+    for(i = 0; i < n && bcache.nbuf < NBUF; i++){
+      b = (struct buf*)page + i;
+      initsleeplock(&b->lock, "buffer");
+      b->hnext = bcache.bucket[0].head;
+      bcache.bucket[0].head = b;
+      if(last == 0)
+        bcache.hand = b;
+      else
+        last->cnext = b;
+      last = b;
+      bcache.nbuf++;
+    }
+  }
+  if(bcache.nbuf < 2*LOGSIZE + MAXOPBLOCKS)
+    panic("binit: too few buffers");
+  last->cnext = bcache.hand;
+}
+
+// Find dev/blockno in its bucket and take a reference.
+// Caller holds bk->lock.
+static struct buf*
+blookup(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->hnext){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      return b;
+    }
+  }
+  return 0;
+}
+
+// Advance the clock hand to an unused buffer and unhash it.
+// Even if refcnt==0, B_DIRTY indicates a buffer is in use
+// because log.c has modified it but not yet committed it.
+// Caller holds bcache.lock.
+static struct buf*
+bevict(void)
+{
+  struct bucket *bk;
+  struct buf *b, **pp;
+  int i;
+
+  for(i = 0; i < 2*bcache.nbuf; i++){
+    b = bcache.hand;
+    bcache.hand = b->cnext;
+    bk = bhash(b->dev, b->blockno);
+    acquire(&bk->lock);
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0){
+      if(b->used){
+        b->used = 0;
+      } else {
+        for(pp = &bk->head; *pp != b; pp = &(*pp)->hnext)
+          ;
+        *pp = b->hnext;
+        release(&bk->lock);
+        return b;
+      }
+    }
+    release(&bk->lock);
   }
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
@@ -61,35 +154,51 @@ binit(void)
 static struct buf*
 bget(uint dev, uint blockno)
 {
+  struct bucket *bk;
   struct buf *b;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  if((b = blookup(bk, dev, blockno)) != 0){
+    bk->hits++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  // Not cached; recycle an unused buffer.  Another process may
+  // have brought the block in meanwhile, so look again once
+  // holding bcache.lock.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = blookup(bk, dev, blockno)) != 0){
+    bk->hits++;
+    release(&bk->lock);
+    release(&bcache.lock);
+    acquiresleep(&b->lock);
+    return b;
   }
-  panic("bget: no buffers");
+  release(&bk->lock);
+
+  if((b = bevict()) == 0)
+    panic("bget: no buffers");
+  bcache.misses++;
+  if(b->flags & B_VALID)
+    bcache.evictions++;
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->refcnt = 1;
+  acquire(&bk->lock);
+  b->hnext = bk->head;
+  bk->head = b;
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -105,6 +214,24 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return n locked bufs holding blocks blockno[0..n-1] of dev,
+// reading the uncached ones with one wait, so the disk can
+// merge them.  Callers lock blocks in file order, which is
+// the same for every reader.
+void
+breadv(uint dev, uint *blockno, struct buf **bufs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    bufs[i] = bget(dev, blockno[i]);
+    if((bufs[i]->flags & B_VALID) == 0)
+      idesubmit(bufs[i]);
+  }
+  for(i = 0; i < n; i++)
+    ideawait(bufs[i]);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -115,30 +242,104 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Write n locked buffers to disk with one wait, so the disk
+// can sort and merge them.
+void
+bwritev(struct buf **bufs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bufs[i]->lock))
+      panic("bwritev");
+    bufs[i]->flags |= B_DIRTY;
+    idesubmit(bufs[i]);
+  }
+  for(i = 0; i < n; i++)
+    ideawait(bufs[i]);
+}
+
+// Start reading a block into the cache without waiting for it.
+// Does nothing if the block is cached or already being read.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct bucket *bk;
+  struct buf *b;
+
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
+  for(b = bk->head; b; b = b->hnext)
+    if(b->dev == dev && b->blockno == blockno)
+      break;
+  release(&bk->lock);
+  if(b)
+    return;
+
+  b = bget(dev, blockno);
+  if(b->flags & B_VALID){
+    brelse(b);
+    return;
+  }
+  b->flags |= B_ASYNC;
+  __sync_fetch_and_add(&bcache.readaheads, 1);
+  idesubmit(b);
+}
+
+// Release a buffer read by breadahead(), on behalf of the
+// process that started the read.  Called from the disk interrupt.
+void
+bfinish(struct buf *b)
+{
+  struct bucket *bk;
+
+  releasesleep(&b->lock);
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  if(--b->refcnt == 0)
+    b->used = 1;
+  release(&bk->lock);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Mark it recently used so the clock passes over it once.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->used = 1;
   }
   
-  release(&bcache.lock);
+  release(&bk->lock);
+}
+
+// Print buffer cache statistics to the console.
+void
+bcachestats(void)
+{
+  struct bucket *bk;
+  uint hits;
+
+  hits = 0;
+  for(bk = bcache.bucket; bk < &bcache.bucket[NBUCKET]; bk++)
+    hits += bk->hits;
+  cprintf("bcache: %d buffers, %d hits %d misses (%d%% hit), %d evictions, "
+          "%d read ahead\n",
+          bcache.nbuf, hits, bcache.misses,
+          hits+bcache.misses ? hits*100/(hits+bcache.misses) : 0,
+          bcache.evictions, bcache.readaheads);
 }
 //PAGEBREAK!
 // Blank page.
-
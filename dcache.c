@@ -0,0 +1,213 @@
+// Directory name cache.
+//
+// The dcache remembers the results of dirlookup(): for a name in
+// directory dir on device dev, the inode it names and the offset
+// of its entry, or that there is no such name (a negative entry,
+// inum 0).  Entries are hashed by (dev, dir, name) into NDHASH
+// chains through hnext and recycled in least-recently-used order
+// through prev/next.
+//
+// Callers hold the directory's inode lock, which also covers its
+// entries' contents, so the cache agrees with the directory:
+// dirlink() enters the names it adds, sys_unlink() drops the
+// names it removes, and iput() drops all entries of a directory
+// it frees.  dcache.lock protects the table itself.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "fs.h"
+
+#define NDENTRY 256
+#define NDHASH   61
+
+struct dentry {
+  uint dev;
+  uint dir;               // inode number of the directory
+  char name[DIRSIZ];
+  uint inum;              // 0 if name is not in dir
+  uint off;               // offset of name's entry in dir
+  struct dentry *hnext;   // hash chain
+  struct dentry *prev;    // LRU list
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDENTRY];
+  struct dentry *hash[NDHASH];
+
+  // Linked list of all entries, through prev/next.
+  // head.next is most recently used.
+  struct dentry head;
+  uint hits;
+  uint neghits;
+  uint misses;
+} dcache;
+
+void
+dcacheinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+  }
+}
+
+static struct dentry**
+dhash(uint dev, uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev * 31 + dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return &dcache.hash[h % NDHASH];
+}
+
+// Find the entry for name in dir.  Caller holds dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = *dhash(dev, dir, name); d; d = d->hnext)
+    if(d->dev == dev && d->dir == dir && strncmp(d->name, name, DIRSIZ) == 0)
+      return d;
+  return 0;
+}
+
+// Take d out of its hash chain.  Caller holds dcache.lock.
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = dhash(d->dev, d->dir, d->name); *pp; pp = &(*pp)->hnext){
+    if(*pp == d){
+      *pp = d->hnext;
+      break;
+    }
+  }
+  d->dir = 0;
+}
+
+// Move d to the head (used) or tail (free) of the LRU list.
+// Caller holds dcache.lock.
+static void
+dmove(struct dentry *d, int used)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  if(used){
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+  } else {
+    d->next = &dcache.head;
+    d->prev = dcache.head.prev;
+  }
+  d->next->prev = d;
+  d->prev->next = d;
+}
+
+// Look name up in directory dir.  Returns 1 and sets *inum (0 if
+// name is known not to exist) and *off if the cache knows,
+// else 0.  Caller holds the directory's lock.
+int
+dcachelookup(uint dev, uint dir, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dev, dir, name)) == 0){
+    dcache.misses++;
+    release(&dcache.lock);
+    return 0;
+  }
+  if(d->inum)
+    dcache.hits++;
+  else
+    dcache.neghits++;
+  *inum = d->inum;
+  *off = d->off;
+  dmove(d, 1);
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dir is inode inum, with its
+// entry at off, or is not there if inum is 0.
+// Caller holds the directory's lock.
+void
+dcacheenter(uint dev, uint dir, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dev, dir, name)) == 0){
+    // Recycle the least recently used entry.
+    d = dcache.head.prev;
+    if(d->dir)
+      dunhash(d);
+    d->dev = dev;
+    d->dir = dir;
+    strncpy(d->name, name, DIRSIZ);
+    d->hnext = *dhash(dev, dir, name);
+    *dhash(dev, dir, name) = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  dmove(d, 1);
+  release(&dcache.lock);
+}
+
+// Forget name in directory dir.
+void
+dcacheremove(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dev, dir, name)) != 0){
+    dunhash(d);
+    dmove(d, 0);
+  }
+  release(&dcache.lock);
+}
+
+// Forget every name in directory dir, which is being freed.
+void
+dcachepurge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    if(d->dir == dir && d->dev == dev){
+      dunhash(d);
+      dmove(d, 0);
+    }
+  }
+  release(&dcache.lock);
+}
+
+// Print name cache statistics to the console.
+void
+dcachestats(void)
+{
+  uint total;
+
+  total = dcache.hits + dcache.neghits + dcache.misses;
+  cprintf("dcache: %d hits %d negative hits %d misses (%d%% hit)\n",
+          dcache.hits, dcache.neghits, dcache.misses,
+          total ? (dcache.hits + dcache.neghits)*100/total : 0);
+}
@@ -12,9 +12,28 @@ struct superblock;
 
 // bio.c
 void            binit(void);
+void            bcachestats(void);
 struct buf*     bread(uint, uint);
+void            breadv(uint, uint*, struct buf**, int);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
+void            breadahead(uint, uint);
+void            bfinish(struct buf*);
+
+// pcache.c
+void            pcacheinit(void);
+char*           pcacheget(struct inode*, uint);
+void            pcacheinval(uint, uint);
+void            pcachestats(void);
+
+// dcache.c
+void            dcacheinit(void);
+int             dcachelookup(uint, uint, char*, uint*, uint*);
+void            dcacheenter(uint, uint, char*, uint, uint);
+void            dcacheremove(uint, uint, char*);
+void            dcachepurge(uint, uint);
+void            dcachestats(void);
 
 // console.c
 void            consoleinit(void);
@@ -33,6 +52,8 @@ void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filesplice(struct file*, struct file*, int);
+int             iwrite(struct inode*, char*, uint*, int);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
@@ -41,6 +62,7 @@ struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit(int dev);
+void            icachestats(void);
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
@@ -50,6 +72,8 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+int             readipipe(struct inode*, struct pipe*, uint, uint);
+void            iprefetch(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
@@ -57,6 +81,8 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idesubmit(struct buf*);
+void            ideawait(struct buf*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -68,6 +94,10 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kincref(char*);
+int             krefcount(char*);
+void            kallocstats(void);
+int             kpages(void);
 
 // kbd.c
 void            kbdintr(void);
@@ -78,6 +108,9 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(int, int);
+void            lapiconeshot(uint);
+uint            lapicperiodic(void);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
@@ -86,6 +119,7 @@ void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
+void            logstats(void);
 
 // mp.c
 extern int      ismp;
@@ -100,6 +134,8 @@ int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
+int             pipewaitroom(struct pipe*);
+int             pipeput(struct pipe*, char*, int);
 
 //PAGEBREAK: 16
 // proc.c
@@ -123,6 +159,8 @@ void            yield(void);
 int             waitx(int *, int *);
 int             set_priority(int, int);
 int             printpinfos(void); 
+void            change_q_flag(struct proc*);
+int             slice_ticks(struct proc*);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -154,6 +192,7 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argrptr(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -165,6 +204,8 @@ void            timerinit(void);
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
+extern uint     tickdeadline;
+void            tickcatchup(uint);
 void            tvinit(void);
 extern struct spinlock tickslock;
 
@@ -184,6 +225,16 @@ void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+pde_t*          cowuvm(pde_t*, uint);
+int             pagefault(pde_t*, uint, uint);
+int             uvmresident(pde_t*);
+uint            uvmsize(struct proc*);
+int             mmap(uint, int, int, struct inode*, uint);
+int             munmap(uint, uint);
+uint            vmabase(struct proc*);
+int             uvmtouch(struct proc*, uint, uint, int);
+int             vmacopy(struct proc*, struct proc*);
+void            vmaclear(struct proc*);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
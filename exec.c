@@ -6,16 +6,18 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "fcntl.h"
 
 int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nseg;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *elfip;
   struct proghdr ph;
+  struct vma seg[NVMA];
   pde_t *pgdir, *oldpgdir;
   struct proc *curproc = myproc();
 
@@ -28,6 +30,7 @@ exec(char *path, char **argv)
   }
   ilock(ip);
   pgdir = 0;
+  elfip = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -38,8 +41,10 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Load program into memory.  Unless EAGEREXEC, only record
+  // each segment; its pages are read in as they are first used.
   sz = 0;
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -49,13 +54,28 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+#ifdef EAGEREXEC
+    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+      goto bad;
     if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
+#else
+    if(ph.vaddr + ph.memsz >= KERNBASE || nseg == NVMA)
+      goto bad;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
+    seg[nseg].addr = ph.vaddr;
+    seg[nseg].len = PGROUNDUP(ph.memsz);
+    seg[nseg].prot = PROT_READ|PROT_WRITE;
+    seg[nseg].flags = MAP_PRIVATE|VMA_EXEC;
+    seg[nseg].off = ph.off;
+    seg[nseg].filesz = ph.filesz;
+    nseg++;
+#endif
   }
+  elfip = idup(ip);
   iunlockput(ip);
   end_op();
   ip = 0;
@@ -94,6 +114,11 @@ exec(char *path, char **argv)
   safestrcpy(curproc->name, last, sizeof(curproc->name));
 
   // Commit to the user image.
+  vmaclear(curproc);
+  for(i = 0; i < nseg; i++){
+    curproc->vma[i] = seg[i];
+    curproc->vma[i].ip = idup(elfip);
+  }
   oldpgdir = curproc->pgdir;
   curproc->pgdir = pgdir;
   curproc->sz = sz;
@@ -101,6 +126,9 @@ exec(char *path, char **argv)
   curproc->tf->esp = sp;
   switchuvm(curproc);
   freevm(oldpgdir);
+  begin_op();
+  iput(elfip);
+  end_op();
   return 0;
 
  bad:
@@ -110,5 +138,10 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(elfip){
+    begin_op();
+    iput(elfip);
+    end_op();
+  }
   return -1;
 }
@@ -0,0 +1,66 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+// fork+exec+exit latency of a large program (usertests) and a
+// small one (echo).
+// Usage: execbench [iterations]
+// Build the kernel with EAGEREXEC=1 to compare against reading
+// the whole program in at exec.
+
+// Time n runs of prog with the given argument vector.
+int
+run(char **args, int n)
+{
+  int i, pid, start;
+
+  start = uptime();
+  for (i = 0; i < n; i++)
+  {
+    pid = fork();
+    if (pid < 0)
+    {
+      printf(1, "execbench: fork failed\n");
+      exit();
+    }
+    if (pid == 0)
+    {
+      close(1);  // keep the console quiet
+      close(2);
+      exec(args[0], args);
+      exit();
+    }
+    wait();
+  }
+  return uptime() - start;
+}
+
+int main(int argc, char *argv[])
+{
+  char *echo[] = { "echo", 0 };
+  char *usertests[] = { "usertests", 0 };
+  int n = 50, fd, made, t;
+
+  if (argc > 1)
+    n = atoi(argv[1]);
+
+  t = run(echo, n);
+  printf(1, "echo: %d execs in %d ticks\n", n, t);
+
+  // usertests quits at once if it has already run.
+  made = 0;
+  if ((fd = open("usertests.ran", 0)) >= 0)
+    close(fd);
+  else
+  {
+    close(open("usertests.ran", O_CREATE));
+    made = 1;
+  }
+  t = run(usertests, n);
+  if (made)
+    unlink("usertests.ran");
+  printf(1, "usertests: %d execs in %d ticks\n", n, t);
+
+  exit();
+}
@@ -5,6 +5,8 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "stat.h"
+#include "mmu.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
@@ -92,6 +94,35 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
+// Before a read of n bytes at f->off, read ahead if f is being
+// read sequentially.  The window starts at 4 blocks past the end of
+// the read and doubles with each sequential read, up to NREADAHEAD.
+// Caller must hold f->ip->lock.
+static void
+filereadahead(struct file *f, uint n)
+{
+  uint first, last;
+
+  if(f->off != f->raoff){
+    f->rawin = 0;
+    f->ranext = 0;
+    return;
+  }
+  if(f->rawin == 0)
+    f->rawin = 4;
+  else if(f->rawin < NREADAHEAD)
+    f->rawin *= 2;
+
+  first = f->off / BSIZE;
+  if(first < f->ranext)
+    first = f->ranext;
+  last = (f->off + n - 1) / BSIZE + f->rawin;
+  if(last >= first){
+    iprefetch(f->ip, first, last - first + 1);
+    f->ranext = last + 1;
+  }
+}
+
 // Read from file f.
 int
 fileread(struct file *f, char *addr, int n)
@@ -104,8 +135,11 @@ fileread(struct file *f, char *addr, int n)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
     ilock(f->ip);
+    if(n > 0)
+      filereadahead(f, n);
     if((r = readi(f->ip, addr, f->off, n)) > 0)
       f->off += r;
+    f->raoff = f->off;
     iunlock(f->ip);
     return r;
   }
@@ -113,45 +147,116 @@ fileread(struct file *f, char *addr, int n)
 }
 
 //PAGEBREAK!
+// Write n bytes to ip at *off, advancing *off, a few blocks
+// per transaction.  Also used to write back shared mappings.
+int
+iwrite(struct inode *ip, char *addr, uint *off, int n)
+{
+  int r = 0;
+
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size, including
+  // i-node, indirect block, allocation blocks,
+  // and 2 blocks of slop for non-aligned writes.
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+  int i = 0;
+  while(i < n){
+    int n1 = n - i;
+    if(n1 > max)
+      n1 = max;
+
+    begin_op();
+    ilock(ip);
+    if ((r = writei(ip, addr + i, *off, n1)) > 0)
+      *off += r;
+    iunlock(ip);
+    end_op();
+
+    if(r < 0)
+      break;
+    if(r != n1)
+      panic("short filewrite");
+    i += r;
+  }
+  return i == n ? n : -1;
+}
+
 // Write to file f.
 int
 filewrite(struct file *f, char *addr, int n)
 {
-  int r;
-
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
     return pipewrite(f->pipe, addr, n);
-  if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r < 0)
-        break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
+  if(f->type == FD_INODE)
+    return iwrite(f->ip, addr, &f->off, n);
+  panic("filewrite");
+}
+
+// Move up to n bytes from file f's inode into pipe p straight
+// from the buffer cache, never sleeping on p while holding the
+// inode.  Returns the bytes moved, or -1.
+static int
+splicepipe(struct file *f, struct pipe *p, int n)
+{
+  int tot, room, r, eof;
+
+  r = 0;
+  for(tot = 0; tot < n; tot += r){
+    if((room = pipewaitroom(p)) < 0){
+      r = -1;
+      break;
     }
-    return i == n ? n : -1;
+    if(room > n - tot)
+      room = n - tot;
+    ilock(f->ip);
+    filereadahead(f, room);
+    if((r = readipipe(f->ip, p, f->off, room)) > 0)
+      f->off += r;
+    f->raoff = f->off;
+    eof = f->off >= f->ip->size;
+    iunlock(f->ip);
+    // 0 with data left means another writer filled the pipe
+    // after pipewaitroom; wait for room again.
+    if(r < 0 || (r == 0 && eof))
+      break;
   }
-  panic("filewrite");
+  if(tot == 0 && r < 0)
+    return -1;
+  return tot;
 }
 
+// Move up to n bytes from in to out inside the kernel, stopping
+// early at the end of in.  A file goes into a pipe straight from
+// the buffer cache; anything else goes through a kernel page.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  char *buf;
+  int tot, r;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type == FD_INODE && in->ip->type != T_DEV && out->type == FD_PIPE)
+    return splicepipe(in, out->pipe, n);
+
+  if((buf = kalloc()) == 0)
+    return -1;
+  r = 0;
+  for(tot = 0; tot < n; tot += r){
+    r = n - tot < PGSIZE ? n - tot : PGSIZE;
+    if((r = fileread(in, buf, r)) <= 0)
+      break;
+    if(filewrite(out, buf, r) != r){
+      r = -1;
+      break;
+    }
+  }
+  kfree(buf);
+  if(tot == 0 && r < 0)
+    return -1;
+  return tot;
+}
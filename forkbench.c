@@ -0,0 +1,74 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// fork+exec latency of a large parent.
+// Usage: forkbench [megabytes] [iterations]
+// Build the kernel with NOCOW=1 to compare against eager copying.
+
+int main(int argc, char *argv[])
+{
+  int mb = 8, n = 20;
+  int i, start, forkticks, execticks;
+  char *mem, *args[3];
+
+  if (argc == 2 && strcmp(argv[1], "-x") == 0)
+    exit();  // exec'd child: nothing to do
+  if (argc > 1)
+    mb = atoi(argv[1]);
+  if (argc > 2)
+    n = atoi(argv[2]);
+
+  mem = sbrk(mb * 1024 * 1024);
+  if (mem == (char*)-1)
+  {
+    printf(1, "forkbench: sbrk %d MB failed\n", mb);
+    exit();
+  }
+  // Touch every page so that an eager fork has to copy it.
+  for (i = 0; i < mb * 1024 * 1024; i += 4096)
+    mem[i] = i;
+
+  // fork, child exits at once
+  start = uptime();
+  for (i = 0; i < n; i++)
+  {
+    int pid = fork();
+    if (pid < 0)
+    {
+      printf(1, "forkbench: fork failed\n");
+      exit();
+    }
+    if (pid == 0)
+      exit();
+    wait();
+  }
+  forkticks = uptime() - start;
+
+  // fork, child execs a tiny program, as sh does
+  args[0] = argv[0];
+  args[1] = "-x";
+  args[2] = 0;
+  start = uptime();
+  for (i = 0; i < n; i++)
+  {
+    int pid = fork();
+    if (pid < 0)
+    {
+      printf(1, "forkbench: fork failed\n");
+      exit();
+    }
+    if (pid == 0)
+    {
+      exec(args[0], args);
+      printf(1, "forkbench: exec %s failed\n", args[0]);
+      exit();
+    }
+    wait();
+  }
+  execticks = uptime() - start;
+
+  printf(1, "%d MB parent, %d iterations: fork+exit %d ticks, fork+exec %d ticks\n",
+         mb, n, forkticks, execticks);
+  exit();
+}
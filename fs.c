@@ -51,30 +51,136 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// bsum keeps, for each bitmap block, the number of free blocks
+// it describes, so that searches skip full bitmap blocks without
+// reading them, and the next-fit cursor where the last search
+// ended.  The bitmap itself, under its buffers' locks, remains
+// the authority; the counts only guide the search.
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+#define NBMAP (FSSIZE/BPB + 1)
+
+static struct {
+  struct spinlock lock;
+  int nfree[NBMAP];
+  uint next;
+} bsum;
+
+// Count the free blocks under each bitmap block.  Runs after
+// log recovery (see forkret), which bypasses the buffer cache.
+static void
+bsuminit(uint dev)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint b, w;
+  int i;
 
-  bp = 0;
+  if(sb.size > NBMAP*BPB)
+    panic("bsuminit: file system too big");
+  initlock(&bsum.lock, "bsum");
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+    for(i = 0; i < BPB/32 && b + i*32 < sb.size; i++){
+      w = ~((uint*)bp->data)[i];
+      if(sb.size - (b + i*32) < 32)
+        w &= (1 << (sb.size - (b + i*32))) - 1;
+      for(; w; w &= w - 1)
+        bsum.nfree[b/BPB]++;
     }
     brelse(bp);
   }
-  panic("balloc: out of blocks");
+  bsum.next = sb.size - sb.nblocks;
+}
+
+// Mark up to n free blocks from b on in bitmap block bp,
+// stopping at the first used one.  Returns how many.
+static int
+bmark(struct buf *bp, uint b, int n)
+{
+  int len, bi, m;
+
+  for(len = 0; len < n && b + len < sb.size; len++){
+    if(len > 0 && (b + len) % BPB == 0)  // next bitmap block
+      break;
+    bi = (b + len) % BPB;
+    m = 1 << (bi % 8);
+    if(bp->data[bi/8] & m)
+      break;
+    bp->data[bi/8] |= m;  // Mark block in use.
+  }
+  log_write(bp);
+  acquire(&bsum.lock);
+  bsum.nfree[b/BPB] -= len;
+  bsum.next = b + len;
+  release(&bsum.lock);
+  return len;
+}
+
+// Allocate up to n contiguous zeroed disk blocks: from goal on
+// if goal is free, so that files stay contiguous, else from the
+// first free block after the last allocation (next fit).
+// Returns the first block and sets *got to the run's length.
+static uint
+balloc_n(uint dev, uint goal, int n, int *got)
+{
+  struct buf *bp;
+  uint b, from, x, *w;
+  int i, k, bmi, nbmap, full, len;
+
+  len = 0;
+  b = goal;
+  if(goal >= sb.size - sb.nblocks && goal < sb.size){
+    bp = bread(dev, BBLOCK(goal, sb));
+    if((bp->data[(goal % BPB)/8] & (1 << (goal % 8))) == 0)  // Is goal free?
+      len = bmark(bp, goal, n);
+    brelse(bp);
+  }
+
+  // Scan the bitmap a word at a time, starting at the cursor's
+  // bitmap block and ending back at it.
+  nbmap = (sb.size + BPB - 1) / BPB;
+  acquire(&bsum.lock);
+  from = bsum.next < sb.size ? bsum.next : 0;
+  release(&bsum.lock);
+  for(k = 0; len == 0 && k <= nbmap; k++){
+    bmi = (from/BPB + k) % nbmap;
+    acquire(&bsum.lock);
+    full = bsum.nfree[bmi] == 0;
+    release(&bsum.lock);
+    if(full)
+      continue;
+    bp = bread(dev, sb.bmapstart + bmi);
+    w = (uint*)bp->data;
+    i = k == 0 ? (from % BPB) / 32 : 0;
+    for(; i < BPB/32; i++){
+      x = ~w[i];
+      if(k == 0 && i == (from % BPB) / 32)
+        x &= ~0U << (from % 32);
+      if(x == 0)
+        continue;
+      b = bmi*BPB + i*32 + __builtin_ctz(x);
+      if(b < sb.size)
+        len = bmark(bp, b, n);
+      break;
+    }
+    brelse(bp);
+  }
+  if(len == 0)
+    panic("balloc: out of blocks");
+
+  *got = len;
+  for(i = 0; i < len; i++)
+    bzero(dev, b + i);
+  return b;
+}
+
+// Allocate a zeroed disk block, goal if it is free.
+static uint
+balloc(uint dev, uint goal)
+{
+  int got;
+
+  return balloc_n(dev, goal, 1, &got);
 }
 
 // Free a disk block.
@@ -92,6 +198,9 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+  acquire(&bsum.lock);
+  bsum.nfree[b/BPB]++;
+  release(&bsum.lock);
 }
 
 // Inodes.
@@ -159,30 +268,78 @@ bfree(int dev, uint b)
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold icache.lock while using any of those fields.
 //
+// Entries are hashed by (dev, inum) through ip->hnext.  Entries
+// with ip->ref zero stay hashed and valid on an LRU list through
+// ip->prev/next, so reopening a file finds it cached; iget()
+// recycles the least recently used one.  The cache starts with
+// an entry per 64 pages of memory (at least NINODE) and grows a
+// page at a time when every entry is referenced; if memory runs
+// out, iget() waits for an iput().
+//
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 127
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+
+  // Unreferenced entries, through prev/next.
+  // lru.next is most recently used.
+  struct inode lru;
+  int ninode;
+  uint hits;
+  uint misses;
 } icache;
 
+// Add a page of entries to the cache's LRU list.
+// Returns 0 if out of memory.  Caller holds icache.lock.
+static int
+igrow(void)
+{
+  struct inode *ip;
+  char *page;
+
+  if((page = kalloc()) == 0)
+    return 0;
+  memset(page, 0, PGSIZE);
+  for(ip = (struct inode*)page; ip + 1 <= (struct inode*)(page + PGSIZE); ip++){
+    initsleeplock(&ip->lock, "inode");
+    ip->next = &icache.lru;
+    ip->prev = icache.lru.prev;
+    ip->prev->next = ip;
+    icache.lru.prev = ip;
+    icache.ninode++;
+  }
+  return 1;
+}
+
 void
 iinit(int dev)
 {
-  int i = 0;
-  
+  int n;
+
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.lru.prev = &icache.lru;
+  icache.lru.next = &icache.lru;
+  n = kpages() / 64;
+  if(n < NINODE)
+    n = NINODE;
+  acquire(&icache.lock);
+  while(icache.ninode < n)
+    if(!igrow())
+      panic("iinit: no memory");
+  release(&icache.lock);
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
           sb.bmapstart);
+  bsuminit(dev);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -230,7 +387,8 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  memmove(dip->ext, ip->ext, sizeof(ip->ext));
+  dip->dind = ip->dind;
   log_write(bp);
   brelse(bp);
 }
@@ -241,31 +399,47 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
-  // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&icache.lock);
-      return ip;
+  for(;;){
+    // Is the inode already cached?
+    for(ip = icache.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+      if(ip->dev == dev && ip->inum == inum){
+        if(ip->ref++ == 0){
+          ip->next->prev = ip->prev;
+          ip->prev->next = ip->next;
+        }
+        icache.hits++;
+        release(&icache.lock);
+        return ip;
+      }
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
-  }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+    // Recycle the least recently used entry, growing
+    // the cache or waiting for an iput() if all are in use.
+    if(icache.lru.prev != &icache.lru)
+      break;
+    if(!igrow())
+      sleep(&icache, &icache.lock);
+  }
 
-  ip = empty;
+  ip = icache.lru.prev;
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+  if(ip->inum){
+    for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = icache.hash[IHASH(dev, inum)];
+  icache.hash[IHASH(dev, inum)] = ip;
+  icache.misses++;
   release(&icache.lock);
 
   return ip;
@@ -303,7 +477,8 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    memmove(ip->ext, dip->ext, sizeof(ip->ext));
+    ip->dind = dip->dind;
     brelse(bp);
     ip->valid = 1;
     if(ip->type == 0)
@@ -338,6 +513,8 @@ iput(struct inode *ip)
     release(&icache.lock);
     if(r == 1){
       // inode has no links and no other references: truncate and free.
+      if(ip->type == T_DIR)
+        dcachepurge(ip->dev, ip->inum);
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
@@ -347,10 +524,30 @@ iput(struct inode *ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0){
+    // Keep it cached; freed inodes are recycled first.
+    if(ip->valid){
+      ip->next = icache.lru.next;
+      ip->prev = &icache.lru;
+    } else {
+      ip->next = &icache.lru;
+      ip->prev = icache.lru.prev;
+    }
+    ip->next->prev = ip;
+    ip->prev->next = ip;
+    wakeup(&icache);
+  }
   release(&icache.lock);
 }
 
+// Print inode cache statistics to the console.
+void
+icachestats(void)
+{
+  cprintf("icache: %d inodes, %d hits %d misses\n",
+          icache.ninode, icache.hits, icache.misses);
+}
+
 // Common idiom: unlock, then put.
 void
 iunlockput(struct inode *ip)
@@ -363,42 +560,116 @@ iunlockput(struct inode *ip)
 // Inode content
 //
 // The content (data) associated with each inode is stored
-// in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// in blocks on the disk. The first blocks are mapped by the
+// extents in ip->ext[], each a run of ip->ext[i].len blocks
+// starting at disk block ip->ext[i].start.  A block appended
+// right after the last extent's run grows it; otherwise it
+// starts a new extent.  Once all NEXTENT extents are in use,
+// the following blocks are listed in the indirect blocks
+// listed in block ip->dind.
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, goal, *a;
   struct buf *bp;
+  struct extent *e;
+
+  // Blocks covered by the extents.
+  goal = 0;
+  for(e = ip->ext; e < &ip->ext[NEXTENT] && e->len > 0; e++){
+    if(bn < e->len)
+      return e->start + bn;
+    bn -= e->len;
+    goal = e->start + e->len;
+  }
 
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
-    return addr;
+  // Appending to the extents: extend the last run if the
+  // block after it is free, else start a new run.
+  addr = 0;
+  if(bn == 0 && ip->dind == 0){
+    addr = balloc(ip->dev, goal);
+    if(e > ip->ext && addr == goal){
+      e[-1].len++;
+      return addr;
+    }
+    if(e < &ip->ext[NEXTENT]){
+      e->start = addr;
+      e->len = 1;
+      return addr;
+    }
   }
-  bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
+  if(bn < MAXFILE){
+    // Load doubly-indirect and indirect blocks, allocating if necessary.
+    if((goal = ip->dind) == 0)
+      ip->dind = goal = balloc(ip->dev, 0);
+    bp = bread(ip->dev, goal);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+    if((goal = a[bn / NINDIRECT]) == 0){
+      a[bn / NINDIRECT] = goal = balloc(ip->dev, 0);
       log_write(bp);
     }
     brelse(bp);
+    bp = bread(ip->dev, goal);
+    a = (uint*)bp->data;
+    if(a[bn % NINDIRECT] == 0){
+      if(addr == 0)
+        addr = balloc(ip->dev, 0);
+      a[bn % NINDIRECT] = addr;
+      log_write(bp);
+    }
+    addr = a[bn % NINDIRECT];
+    brelse(bp);
     return addr;
   }
 
   panic("bmap: out of range");
 }
 
+// Allocate blocks bn..bn+n-1 of ip, which a write is about to
+// append, as a few contiguous runs added to the extents rather
+// than one block at a time.  Blocks past the extents are left
+// to bmap().
+static void
+bprealloc(struct inode *ip, uint bn, uint n)
+{
+  struct extent *e;
+  uint start, goal;
+  int got;
+
+  if(ip->dind)
+    return;
+  goal = 0;
+  for(e = ip->ext; e < &ip->ext[NEXTENT] && e->len > 0; e++){
+    if(bn + n <= e->len)
+      return;
+    if(bn < e->len){
+      n -= e->len - bn;
+      bn = 0;
+    } else
+      bn -= e->len;
+    goal = e->start + e->len;
+  }
+  if(bn != 0)
+    return;
+
+  while(n > 0 && e < &ip->ext[NEXTENT]){
+    start = balloc_n(ip->dev, goal, n, &got);
+    if(e > ip->ext && start == goal){
+      e[-1].len += got;
+    } else {
+      e->start = start;
+      e->len = got;
+      e++;
+    }
+    goal = start + got;
+    n -= got;
+  }
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -408,26 +679,36 @@ static void
 itrunc(struct inode *ip)
 {
   int i, j;
-  struct buf *bp;
-  uint *a;
-
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
+  struct buf *bp, *ibp;
+  struct extent *e;
+  uint *a, *ia, b;
+
+  pcacheinval(ip->dev, ip->inum);
+  for(e = ip->ext; e < &ip->ext[NEXTENT]; e++){
+    for(b = 0; b < e->len; b++)
+      bfree(ip->dev, e->start + b);
+    e->start = 0;
+    e->len = 0;
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+  if(ip->dind){
+    bp = bread(ip->dev, ip->dind);
     a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+    for(i = 0; i < NINDIRECT; i++){
+      if(a[i] == 0)
+        continue;
+      ibp = bread(ip->dev, a[i]);
+      ia = (uint*)ibp->data;
+      for(j = 0; j < NINDIRECT; j++){
+        if(ia[j])
+          bfree(ip->dev, ia[j]);
+      }
+      brelse(ibp);
+      bfree(ip->dev, a[i]);
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    bfree(ip->dev, ip->dind);
+    ip->dind = 0;
   }
 
   ip->size = 0;
@@ -453,7 +734,13 @@ int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
   uint tot, m;
+#ifdef BLOCKREAD
   struct buf *bp;
+#else
+  uint i, nb, o, c, bn[PGSIZE/BSIZE+1];
+  struct buf *bufs[PGSIZE/BSIZE+1];
+  char *d;
+#endif
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -466,15 +753,79 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+#ifdef BLOCKREAD
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
   }
+#else
+  // A page of dst at a time: read all the blocks behind it
+  // with one wait, then copy them straight into it.
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    m = min(n - tot, PGSIZE - (uint)dst%PGSIZE);
+    nb = (off%BSIZE + m + BSIZE-1) / BSIZE;
+    for(i = 0; i < nb; i++)
+      bn[i] = bmap(ip, off/BSIZE + i);
+    breadv(ip->dev, bn, bufs, nb);
+    for(i = 0, o = off%BSIZE, d = dst; i < nb; i++, o = 0){
+      c = min(m - (d - dst), BSIZE - o);
+      memmove(d, bufs[i]->data + o, c);
+      d += c;
+      brelse(bufs[i]);
+    }
+  }
+#endif
   return n;
 }
 
+// Copy up to n bytes of ip from off into pipe p, straight from
+// the buffer cache, stopping early if p fills up.  Returns the
+// bytes copied, or -1 if p's read side is closed.
+// Caller must hold ip->lock.
+int
+readipipe(struct inode *ip, struct pipe *p, uint off, uint n)
+{
+  uint tot, m;
+  int r;
+  struct buf *bp;
+
+  if(off > ip->size || off + n < off)
+    return 0;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot=0; tot<n; tot+=r, off+=r){
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    m = min(n - tot, BSIZE - off%BSIZE);
+    r = pipeput(p, (char*)bp->data + off%BSIZE, m);
+    brelse(bp);
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    if(r < m){
+      tot += r;
+      break;
+    }
+  }
+  return tot;
+}
+
+// Start reading up to n blocks of ip from block bn on into
+// the buffer cache, without waiting for them.
+// Caller must hold ip->lock.
+void
+iprefetch(struct inode *ip, uint bn, uint n)
+{
+  uint end;
+
+  if(ip->type == T_DEV)
+    return;
+  end = (ip->size + BSIZE - 1) / BSIZE;
+  for(; n > 0 && bn < end; bn++, n--)
+    breadahead(ip->dev, bmap(ip, bn));
+}
+
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
@@ -495,6 +846,10 @@ writei(struct inode *ip, char *src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  if(n > 0){
+    pcacheinval(ip->dev, ip->inum);
+    bprealloc(ip, off/BSIZE, (off + n - 1)/BSIZE - off/BSIZE + 1);
+  }
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -503,8 +858,11 @@ writei(struct inode *ip, char *src, uint off, uint n)
     brelse(bp);
   }
 
-  if(n > 0 && off > ip->size){
-    ip->size = off;
+  if(n > 0){
+    if(off > ip->size)
+      ip->size = off;
+    // write the i-node back to disk even if the size didn't change
+    // because the loop above might have grown an extent.
     iupdate(ip);
   }
   return n;
@@ -530,6 +888,14 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(dcachelookup(dp->dev, dp->inum, name, &inum, &off)){
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -540,10 +906,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcacheenter(dp->dev, dp->inum, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcacheenter(dp->dev, dp->inum, name, 0, 0);
   return 0;
 }
 
@@ -573,6 +941,7 @@ dirlink(struct inode *dp, char *name, uint inum)
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcacheenter(dp->dev, dp->inum, name, inum, off);
 
   return 0;
 }
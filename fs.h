@@ -21,9 +21,27 @@ struct superblock {
   uint bmapstart;    // Block number of first free map block
 };
 
-#define NDIRECT 12
+// Log header, the first log block.  A transaction commits when
+// a header whose cksum matches its blocks is on disk.
+#define LOGMAX (BSIZE/sizeof(uint) - 2)  // most blocks a header lists
+struct logheader {
+  int n;             // Number of logged blocks
+  uint cksum;        // Checksum of block numbers and log copies
+  int block[LOGMAX]; // Home block numbers
+};
+
+// A file's blocks are mapped by up to NEXTENT extents, runs of
+// consecutive disk blocks, in file order.  Once they are used up,
+// the blocks after them are listed through a doubly-indirect block:
+// dind holds NINDIRECT indirect blocks of NINDIRECT block numbers.
+#define NEXTENT 6
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define MAXFILE (NINDIRECT * NINDIRECT)
+
+struct extent {
+  uint start;           // First disk block
+  uint len;             // Number of blocks, 0 if unused
+};
 
 // On-disk inode structure
 struct dinode {
@@ -32,7 +50,8 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  struct extent ext[NEXTENT]; // Data block runs
+  uint dind;            // Doubly-indirect block for the rest
 };
 
 // Inodes per block.
@@ -0,0 +1,340 @@
+// Check an xv6 file system image, replaying its log first
+// as the kernel would at boot.  Used by crashtest.
+// Usage: fsck [-n] fs.img   (-n: don't replay or write the image)
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdarg.h>
+
+#define stat xv6_stat  // avoid clash with host struct stat
+#include "types.h"
+#include "fs.h"
+#include "stat.h"
+#include "param.h"
+
+int fsfd;
+int nowrite;
+struct superblock sb;
+uchar *used;    // blocks referenced by inodes or metadata
+ushort *refs;   // directory entries naming each inode
+uchar *seen;    // directories already walked
+int errors;
+
+// convert from intel byte order
+uint
+xint(uint x)
+{
+  uint y;
+  uchar *a = (uchar*)&x;
+  y = a[0] | a[1] << 8 | a[2] << 16 | a[3] << 24;
+  return y;
+}
+
+ushort
+xshort(ushort x)
+{
+  uchar *a = (uchar*)&x;
+  return a[0] | a[1] << 8;
+}
+
+void
+rsect(uint sec, void *buf)
+{
+  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
+    perror("lseek");
+    exit(1);
+  }
+  if(read(fsfd, buf, BSIZE) != BSIZE){
+    perror("read");
+    exit(1);
+  }
+}
+
+void
+wsect(uint sec, void *buf)
+{
+  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE){
+    perror("lseek");
+    exit(1);
+  }
+  if(write(fsfd, buf, BSIZE) != BSIZE){
+    perror("write");
+    exit(1);
+  }
+}
+
+void
+rinode(uint inum, struct dinode *ip)
+{
+  char buf[BSIZE];
+
+  rsect(IBLOCK(inum, sb), buf);
+  *ip = ((struct dinode*)buf)[inum % IPB];
+}
+
+void
+error(char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  printf("fsck: ");
+  vprintf(fmt, ap);
+  printf("\n");
+  va_end(ap);
+  errors++;
+}
+
+// Same checksum as logsum() in log.c.
+uint
+logsum(struct logheader *lh, uchar (*blocks)[BSIZE])
+{
+  uint sum, w;
+  int i, j;
+
+  sum = 2166136261U;
+  for(i = 0; i < lh->n; i++){
+    sum = (sum ^ lh->block[i]) * 16777619;
+    for(j = 0; j < BSIZE; j += sizeof(uint)){
+      memmove(&w, blocks[i] + j, sizeof(w));
+      sum = (sum ^ w) * 16777619;
+    }
+  }
+  return sum;
+}
+
+// Install a committed transaction from the log, or drop a
+// torn one, like recover_from_log().
+void
+replay(void)
+{
+  static uchar blocks[LOGMAX][BSIZE];
+  struct logheader lh;
+  uchar buf[BSIZE];
+  int i;
+
+  rsect(sb.logstart, buf);
+  memmove(&lh, buf, sizeof(lh));
+  lh.n = xint(lh.n);
+  lh.cksum = xint(lh.cksum);
+  if(lh.n == 0){
+    printf("fsck: log is empty\n");
+    return;
+  }
+  if(lh.n < 0 || lh.n > LOGMAX || lh.n >= sb.nlog){
+    error("log header has %d blocks", lh.n);
+    return;
+  }
+  for(i = 0; i < lh.n; i++){
+    lh.block[i] = xint(lh.block[i]);
+    rsect(sb.logstart + 1 + i, blocks[i]);
+  }
+  if(logsum(&lh, blocks) != lh.cksum){
+    printf("fsck: discarding torn commit of %d blocks\n", lh.n);
+  } else {
+    printf("fsck: replaying %d logged blocks\n", lh.n);
+    for(i = 0; i < lh.n; i++){
+      if(lh.block[i] < sb.inodestart || lh.block[i] >= sb.size){
+        error("log names block %d", lh.block[i]);
+        return;
+      }
+      if(!nowrite)
+        wsect(lh.block[i], blocks[i]);
+    }
+  }
+  memset(buf, 0, sizeof(buf));
+  if(!nowrite)
+    wsect(sb.logstart, buf);
+}
+
+// Claim block b for inode inum.
+void
+claim(uint inum, uint b)
+{
+  if(b < sb.size - sb.nblocks || b >= sb.size){
+    error("inode %d: block %d out of range", inum, b);
+    return;
+  }
+  if(used[b])
+    error("inode %d: block %d used twice", inum, b);
+  used[b] = 1;
+}
+
+// Block holding byte off of an inode, 0 if none.
+uint
+bmap(struct dinode *din, uint off)
+{
+  uint bn, i, ind[NINDIRECT];
+
+  bn = off / BSIZE;
+  for(i = 0; i < NEXTENT && xint(din->ext[i].len) > 0; i++){
+    if(bn < xint(din->ext[i].len))
+      return xint(din->ext[i].start) + bn;
+    bn -= xint(din->ext[i].len);
+  }
+  if(bn >= MAXFILE || xint(din->dind) == 0)
+    return 0;
+  rsect(xint(din->dind), ind);
+  if(xint(ind[bn / NINDIRECT]) == 0 || xint(ind[bn / NINDIRECT]) >= sb.size)
+    return 0;
+  rsect(xint(ind[bn / NINDIRECT]), ind);
+  return xint(ind[bn % NINDIRECT]);
+}
+
+void
+checkinode(uint inum, struct dinode *din)
+{
+  uint i, j, b, dind[NINDIRECT], ind[NINDIRECT];
+
+  if(xint(din->size) > MAXFILE*BSIZE)
+    error("inode %d: size %d too big", inum, xint(din->size));
+  for(i = 0; i < NEXTENT; i++){
+    if(xint(din->ext[i].len) > sb.nblocks)
+      error("inode %d: extent %d has %d blocks", inum, i, xint(din->ext[i].len));
+    else
+      for(b = 0; b < xint(din->ext[i].len); b++)
+        claim(inum, xint(din->ext[i].start) + b);
+  }
+  if(xint(din->dind) == 0)
+    return;
+  claim(inum, xint(din->dind));
+  if(xint(din->dind) >= sb.size)
+    return;
+  rsect(xint(din->dind), dind);
+  for(i = 0; i < NINDIRECT; i++){
+    if(xint(dind[i]) == 0)
+      continue;
+    claim(inum, xint(dind[i]));
+    if(xint(dind[i]) >= sb.size)
+      continue;
+    rsect(xint(dind[i]), ind);
+    for(j = 0; j < NINDIRECT; j++)
+      if(xint(ind[j]))
+        claim(inum, xint(ind[j]));
+  }
+}
+
+// Count the entries naming each inode under directory inum.
+void
+walk(uint inum)
+{
+  struct dinode din, child;
+  struct dirent de[BSIZE / sizeof(struct dirent)];
+  uint off, b, i, ci;
+
+  if(seen[inum])
+    return;
+  seen[inum] = 1;
+  rinode(inum, &din);
+  for(off = 0; off < xint(din.size); off += BSIZE){
+    if((b = bmap(&din, off)) == 0 || b >= sb.size)
+      continue;
+    rsect(b, de);
+    for(i = 0; i < BSIZE / sizeof(struct dirent); i++){
+      if((ci = xshort(de[i].inum)) == 0)
+        continue;
+      if(ci >= sb.ninodes){
+        error("directory %d: bad inode %d", inum, ci);
+        continue;
+      }
+      rinode(ci, &child);
+      if(child.type == 0){
+        error("directory %d: entry for free inode %d", inum, ci);
+        continue;
+      }
+      if(strncmp(de[i].name, ".", DIRSIZ) == 0)
+        continue;
+      refs[ci]++;
+      if(xshort(child.type) == T_DIR && strncmp(de[i].name, "..", DIRSIZ) != 0)
+        walk(ci);
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  uchar buf[BSIZE];
+  struct dinode din;
+  uint inum, b;
+
+  if(argc > 1 && strcmp(argv[1], "-n") == 0){
+    nowrite = 1;
+    argc--;
+    argv++;
+  }
+  if(argc < 2){
+    fprintf(stderr, "Usage: fsck [-n] fs.img\n");
+    exit(1);
+  }
+  fsfd = open(argv[1], nowrite ? O_RDONLY : O_RDWR);
+  if(fsfd < 0){
+    perror(argv[1]);
+    exit(1);
+  }
+
+  rsect(1, buf);
+  memmove(&sb, buf, sizeof(sb));
+  sb.size = xint(sb.size);
+  sb.nblocks = xint(sb.nblocks);
+  sb.ninodes = xint(sb.ninodes);
+  sb.nlog = xint(sb.nlog);
+  sb.logstart = xint(sb.logstart);
+  sb.inodestart = xint(sb.inodestart);
+  sb.bmapstart = xint(sb.bmapstart);
+  if(sb.size == 0 || sb.nblocks >= sb.size || sb.bmapstart >= sb.size){
+    fprintf(stderr, "fsck: %s: bad superblock\n", argv[1]);
+    exit(1);
+  }
+
+  replay();
+
+  used = calloc(sb.size, 1);
+  refs = calloc(sb.ninodes, sizeof(ushort));
+  seen = calloc(sb.ninodes, 1);
+
+  for(inum = 1; inum < sb.ninodes; inum++){
+    rinode(inum, &din);
+    if(din.type == 0)
+      continue;
+    if(xshort(din.type) != T_DIR && xshort(din.type) != T_FILE &&
+       xshort(din.type) != T_DEV)
+      error("inode %d: bad type %d", inum, xshort(din.type));
+    else
+      checkinode(inum, &din);
+  }
+
+  for(b = sb.size - sb.nblocks; b < sb.size; b++){
+    rsect(BBLOCK(b, sb), buf);
+    if(((buf[(b % BPB) / 8] >> (b % 8)) & 1) != used[b])
+      error(used[b] ? "block %d used but free in bitmap" :
+            "block %d marked in bitmap but unused", b);
+  }
+
+  rinode(ROOTINO, &din);
+  if(xshort(din.type) != T_DIR)
+    error("root inode %d is not a directory", ROOTINO);
+  else
+    walk(ROOTINO);
+
+  for(inum = 1; inum < sb.ninodes; inum++){
+    rinode(inum, &din);
+    if(din.type == 0)
+      continue;
+    if(refs[inum] == 0 && din.nlink == 0)
+      printf("fsck: inode %d is orphaned (unlinked while open)\n", inum);
+    else if(refs[inum] != xshort(din.nlink))
+      error("inode %d: nlink %d but %d directory entries",
+            inum, xshort(din.nlink), refs[inum]);
+  }
+
+  if(errors){
+    printf("fsck: %s: %d errors\n", argv[1], errors);
+    exit(1);
+  }
+  printf("fsck: %s: ok\n", argv[1]);
+  exit(0);
+}
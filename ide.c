@@ -24,15 +24,26 @@
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+#define IDE_MAXRUN    16  // most adjacent blocks merged into one command
+
+// Requests wait in two lists sorted by block number, through qnext.
+// idequeue holds the blocks at or after idepos, which the disk
+// reaches on its current upward sweep; idenext holds the ones
+// behind it, which are served on the next sweep (C-SCAN).
+// ideactive is the run of adjacent blocks being transferred by the
+// current command; idecur/idesect is the next sector to move.
+// You must hold idelock while manipulating the queues.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static struct buf *idenext;
+static struct buf *ideactive;
+static struct buf *idecur;
+static int idesect;
+static uint idepos;
 
 static int havedisk1;
-static void idestart(struct buf*);
+static void idestart(void);
 
 // Wait for IDE disk to become ready.
 static int
@@ -69,33 +80,73 @@ ideinit(void)
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Move the next sector of the active run to or from the disk.
 static void
-idestart(struct buf *b)
+idexfer(void)
 {
-  if(b == 0)
+  uchar *p;
+
+  p = idecur->data + idesect*SECTOR_SIZE;
+  if(idecur->flags & B_DIRTY)
+    outsl(0x1f0, p, SECTOR_SIZE/4);
+  else
+    insl(0x1f0, p, SECTOR_SIZE/4);
+  if(++idesect == BSIZE/SECTOR_SIZE){
+    idesect = 0;
+    idecur = idecur->qnext;
+  }
+}
+
+// Start the next request, merged with the requests for the blocks
+// right after it.  Caller must hold idelock.
+static void
+idestart(void)
+{
+  struct buf *b, *last;
+  int n;
+
+  if(idequeue == 0){
+    idequeue = idenext;
+    idenext = 0;
+  }
+  if((b = idequeue) == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
+
+  // Take the longest run of consecutive blocks going the same way.
+  last = b;
+  idequeue = b->qnext;
+  for(n = 1; n < IDE_MAXRUN && idequeue; n++){
+    if(idequeue->dev != b->dev || idequeue->blockno != last->blockno+1 ||
+       (idequeue->flags & B_DIRTY) != (b->flags & B_DIRTY))
+      break;
+    last = idequeue;
+    idequeue = idequeue->qnext;
+  }
+  last->qnext = 0;
+  ideactive = idecur = b;
+  idesect = 0;
+  idepos = last->blockno + 1;
+
+  if(last->blockno >= FSSIZE)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
   if (sector_per_block > 7) panic("idestart");
 
+  // READ/WRITE SECTORS interrupt once per sector.
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, n * sector_per_block);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
   if(b->flags & B_DIRTY){
-    outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    outb(0x1f7, IDE_CMD_WRITE);
+    idexfer();
   } else {
-    outb(0x1f7, read_cmd);
+    outb(0x1f7, IDE_CMD_READ);
   }
 }
 
@@ -105,37 +156,56 @@ ideintr(void)
 {
   struct buf *b;
 
-  // First queued buffer is the active request.
   acquire(&idelock);
 
-  if((b = idequeue) == 0){
+  if(ideactive == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  // A read interrupts when a sector is ready, a write when a sector
+  // has been taken and once more when the whole command is done.
+  if(idecur != 0){
+    if(ideactive->flags & B_DIRTY)
+      idexfer();
+    else if(idewait(1) >= 0)
+      idexfer();
+    else
+      idecur = 0;
+    if(idecur != 0 || (ideactive->flags & B_DIRTY)){
+      release(&idelock);
+      return;
+    }
+  }
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  // The command is done.  Wake the processes waiting for its bufs,
+  // or release the ones nobody waits for.
+  while((b = ideactive) != 0){
+    ideactive = b->qnext;
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->flags & B_ASYNC){
+      b->flags &= ~B_ASYNC;
+      bfinish(b);
+    } else
+      wakeup(b);
+  }
 
   // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  if(idequeue != 0 || idenext != 0)
+    idestart();
 
   release(&idelock);
 }
 
 //PAGEBREAK!
-// Sync buf with disk.
+// Queue b to be synced with the disk and return without waiting.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If B_ASYNC is set the buffer is released once done, else the
+// caller must ideawait() it.
 void
-iderw(struct buf *b)
+idesubmit(struct buf *b)
 {
   struct buf **pp;
 
@@ -148,21 +218,35 @@ iderw(struct buf *b)
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
+  // Insert b in sweep order.
+  pp = b->blockno >= idepos ? &idequeue : &idenext;
+  for(; *pp && (*pp)->blockno <= b->blockno; pp=&(*pp)->qnext)  //DOC:insert-queue
     ;
+  b->qnext = *pp;
   *pp = b;
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(ideactive == 0)
+    idestart();
+
+  release(&idelock);
+}
 
-  // Wait for request to finish.
+// Wait for a request queued by idesubmit() to finish.
+void
+ideawait(struct buf *b)
+{
+  acquire(&idelock);
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
     sleep(b, &idelock);
   }
-
-
   release(&idelock);
 }
+
+// Sync buf with disk.
+void
+iderw(struct buf *b)
+{
+  idesubmit(b);
+  ideawait(b);
+}
@@ -7,6 +7,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
 
 void freerange(void *vstart, void *vend);
@@ -21,13 +22,44 @@ struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  int npage;                   // pages given to the allocator
+  ushort ref[PHYSTOP/PGSIZE];  // references to each page, 0 if free
 } kmem;
 
+// Each CPU keeps a small magazine of free pages so that most
+// kalloc()/kfree() calls need neither kmem.lock nor a shared
+// cache line.  A magazine is refilled from, and drained to,
+// kmem.freelist KBATCH pages at a time, under one acquire.
+// Only touched by its own CPU with interrupts off.
+#define KCACHE  32   // most pages a CPU holds
+#define KBATCH  16   // pages moved per refill or drain
+
+struct kcache {
+  struct run *list;
+  int n;
+  uint hits;         // kalloc served from the magazine
+  uint refills;      // kalloc had to go to kmem.freelist
+  uint drains;       // kfree overflowed to kmem.freelist
+  uint locks;        // kmem.lock acquisitions
+  uint contended;    // ... that found it already held
+} kcache[NCPU];
+
+static void
+lockkmem(struct kcache *c)
+{
+  c->locks++;
+  if(kmem.lock.locked)
+    c->contended++;
+  acquire(&kmem.lock);
+}
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+// Until kinit2() is done there is one CPU running and no
+// per-CPU caching.
 void
 kinit1(void *vstart, void *vend)
 {
@@ -48,32 +80,74 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
     kfree(p);
+    kmem.npage++;
+  }
+}
+
+// Number of pages of physical memory the allocator manages,
+// for sizing caches at boot.
+int
+kpages(void)
+{
+  return kmem.npage;
 }
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
+// call to kalloc(), and free it once nobody refers to it.
+// (The exception is when initializing the allocator;
+// see kinit above.)
 void
 kfree(char *v)
 {
-  struct run *r;
+  struct run *r, *last;
+  struct kcache *c;
+  ushort *ref;
+  int i;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  ref = &kmem.ref[V2P(v)/PGSIZE];
+  if(*ref > 1 && __sync_sub_and_fetch(ref, 1) > 0)
+    return;
+  *ref = 0;
+
+#ifdef DEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  if(!kmem.use_lock){
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+    return;
+  }
+
+  pushcli();
+  c = &kcache[cpuid()];
+  r->next = c->list;
+  c->list = r;
+  if(++c->n > KCACHE){
+    // Give the KBATCH least recently freed pages back.
+    last = c->list;
+    for(i = 1; i < c->n - KBATCH; i++)
+      last = last->next;
+    r = last->next;
+    last->next = 0;
+    c->n -= KBATCH;
+    c->drains++;
+    for(last = r; last->next; last = last->next)
+      ;
+    lockkmem(c);
+    last->next = kmem.freelist;
+    kmem.freelist = r;
     release(&kmem.lock);
+  }
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +157,78 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcache *c;
+
+  if(!kmem.use_lock){
+    r = kmem.freelist;
+    if(r){
+      kmem.freelist = r->next;
+      kmem.ref[V2P(r)/PGSIZE] = 1;
+    }
+    return (char*)r;
+  }
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
+  pushcli();
+  c = &kcache[cpuid()];
+  if(c->list)
+    c->hits++;
+  else {
+    c->refills++;
+    lockkmem(c);
+    while(c->n < KBATCH && (r = kmem.freelist) != 0){
+      kmem.freelist = r->next;
+      r->next = c->list;
+      c->list = r;
+      c->n++;
+    }
     release(&kmem.lock);
+  }
+  r = c->list;
+  if(r){
+    c->list = r->next;
+    c->n--;
+    kmem.ref[V2P(r)/PGSIZE] = 1;
+  }
+  popcli();
   return (char*)r;
 }
 
+// Add a reference to an allocated page, e.g. when
+// fork shares it copy-on-write.
+void
+kincref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kincref");
+  if(kmem.ref[V2P(v)/PGSIZE] == 0)
+    panic("kincref: free page");
+  __sync_fetch_and_add(&kmem.ref[V2P(v)/PGSIZE], 1);
+}
+
+// Number of references to an allocated page.
+int
+krefcount(char *v)
+{
+  return kmem.ref[V2P(v)/PGSIZE];
+}
+
+// Print allocator statistics to the console.
+void
+kallocstats(void)
+{
+  struct kcache *c;
+  uint hits, refills, drains, locks, contended;
+
+  hits = refills = drains = locks = contended = 0;
+  for(c = kcache; c < &kcache[ncpu]; c++){
+    hits += c->hits;
+    refills += c->refills;
+    drains += c->drains;
+    locks += c->locks;
+    contended += c->contended;
+  }
+  cprintf("kalloc: %d hits %d refills (%d%% hit), %d drains, "
+          "kmem.lock %d acquires %d contended\n",
+          hits, refills, hits+refills ? hits*100/(hits+refills) : 0,
+          drains, locks, contended);
+}
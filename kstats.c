@@ -0,0 +1,13 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+int main(int argc, char *argv[])
+{
+    if (argc != 1)
+        printf(1,"Usage: kstats\n");
+    else
+        printkstats();  // kernel prints its counters to the console
+
+    exit();
+}
@@ -41,6 +41,8 @@
 #define TCCR    (0x0390/4)   // Timer Current Count
 #define TDCR    (0x03E0/4)   // Timer Divide Configuration
 
+#define TICKCYCLES 10000000  // timer counts per tick
+
 volatile uint *lapic;  // Initialized in mp.c
 
 //PAGEBREAK!
@@ -66,7 +68,7 @@ lapicinit(void)
   // TICR would be calibrated using an external time source.
   lapicw(TDCR, X1);
   lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  lapicw(TICR, TICKCYCLES);
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -113,6 +115,51 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Send interrupt vector to the CPU whose local APIC id is apicid.
+// Must be called with interrupts disabled.
+void
+lapicipi(int apicid, int vector)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
+// Replace the periodic timer by a single interrupt
+// n ticks from now, or by none at all if n is 0.
+void
+lapiconeshot(uint n)
+{
+  if(!lapic)
+    return;
+  if(n == 0){
+    lapicw(TIMER, MASKED | (T_IRQ0 + IRQ_TIMER));
+    lapicw(TICR, 0);
+    return;
+  }
+  lapicw(TIMER, T_IRQ0 + IRQ_TIMER);
+  lapicw(TICR, n * TICKCYCLES);
+}
+
+// Restart the periodic timer after lapiconeshot().
+// Returns the number of whole ticks that passed since.
+uint
+lapicperiodic(void)
+{
+  uint init, left;
+
+  if(!lapic)
+    return 0;
+  init = lapic[TICR];
+  left = lapic[TCCR];
+  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
+  lapicw(TICR, TICKCYCLES);
+  return (init - left) / TICKCYCLES;
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
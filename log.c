@@ -5,6 +5,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "mmu.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -20,48 +21,115 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// The log is double-buffered: a commit first copies the
+// transaction's blocks out of the buffer cache into its own
+// buffers, and from then on new FS system calls fill the next
+// transaction while the copies are written to the log and
+// installed.  The end_op() that finds no FS system calls active
+// commits; if a commit is already running, the committer picks
+// the new transaction up when it finishes (group commit).  When
+// the last commit batched several system calls, end_op() also
+// waits up to LOGWINDOW ticks for more to join before committing.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
+//     and a checksum over them and the log blocks
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Its size is set by mkfs in the superblock.
+// The header is written together with the log blocks as one
+// batch; a crash in the middle leaves a header whose checksum
+// doesn't match, and recovery ignores it.  The header (struct
+// logheader, in fs.h) is used both on disk and in memory to keep
+// track of logged block# before commit.
 
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
-struct logheader {
-  int n;
-  int block[LOGSIZE];
-};
+#define LOGWINDOW 1  // ticks end_op() waits for more FS calls to join
 
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // blocks in the log after the header
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int copying;     // commit() is copying the transaction's blocks
+  int nops;        // FS sys calls in the filling transaction
+  int lastnops;    // FS sys calls in the last committed transaction
+  uint ncommit;    // statistics: commits
+  uint ncommitops; // and the FS sys calls they held
   int dev;
-  struct logheader lh;
+  struct logheader lh;  // filling transaction
+  struct logheader clh; // committing transaction
+  uint ntorn;      // statistics: transactions discarded by recovery
 };
 struct log log;
 
+// The committing transaction's blocks.  These are not in the
+// buffer cache, so their blockno can be pointed at the log
+// and then at the home location.
+static struct buf *lbuf[LOGMAX];
+
+// The header and the log blocks, written by write_log().
+static struct buf *cbuf[LOGMAX+1];
+
 static void recover_from_log(void);
 static void commit();
 
+#ifdef LOGCRASH
+// Crash-recovery testing (see crashtest): stop the machine at the
+// LOGCRASH'th commit, right after its commit record is written,
+// or for -LOGCRASH with only the header and the first half of
+// its log written, as if the disk had lost the rest.
+// Called before and after write_log() writes the log.
+static void
+logcrash(void)
+{
+  static int calls;
+  int n;
+
+  n = LOGCRASH < 0 ? -LOGCRASH : LOGCRASH;
+  if(++calls != 2*n - (LOGCRASH < 0))
+    return;
+  if(LOGCRASH < 0)
+    bwritev(cbuf, 1 + log.clh.n/2);
+  cprintf("log: crash at commit %d\n", n);
+  for(;;)
+    ;
+}
+#endif
+
 void
 initlog(int dev)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
   struct superblock sb;
+  char *page;
+  int i;
+
   initlock(&log.lock, "log");
   readsb(dev, &sb);
   log.start = sb.logstart;
-  log.size = sb.nlog;
+  log.size = sb.nlog - 1;
+  if(log.size > LOGMAX)
+    log.size = LOGMAX;
+  if(log.size < MAXOPBLOCKS)
+    panic("initlog: log too small");
   log.dev = dev;
+
+  page = 0;
+  for(i = 0; i < log.size; i++){
+    if(i % (PGSIZE/sizeof(struct buf)) == 0 && (page = kalloc()) == 0)
+      panic("initlog: out of memory");
+    lbuf[i] = (struct buf*)page + i % (PGSIZE/sizeof(struct buf));
+    memset(lbuf[i], 0, sizeof(struct buf));
+    initsleeplock(&lbuf[i]->lock, "logbuf");
+    lbuf[i]->dev = dev;
+  }
+
   recover_from_log();
 }
 
@@ -71,14 +139,9 @@ install_trans(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
-  }
+  for (tail = 0; tail < log.clh.n; tail++)
+    lbuf[tail]->blockno = log.clh.block[tail];
+  bwritev(lbuf, log.clh.n);  // write dsts to disk
 }
 
 // Read the log header from disk into the in-memory log header
@@ -88,36 +151,81 @@ read_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.clh.n = lh->n;
+  log.clh.cksum = lh->cksum;
+  if (log.clh.n < 0 || log.clh.n > log.size)
+    log.clh.n = 0;
+  for (i = 0; i < log.clh.n; i++) {
+    log.clh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Copy the in-memory log header into the header block.
 static void
-write_head(void)
+fill_head(struct buf *buf)
 {
-  struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = log.clh.n;
+  hb->cksum = log.clh.cksum;
+  for (i = 0; i < log.clh.n; i++) {
+    hb->block[i] = log.clh.block[i];
   }
+}
+
+// Write in-memory log header to disk.
+static void
+write_head(void)
+{
+  struct buf *buf = bread(log.dev, log.start);
+  fill_head(buf);
   bwrite(buf);
   brelse(buf);
 }
 
+// Checksum of the committing transaction: its block numbers and
+// the contents of the commit buffers (32-bit FNV-1a over words).
+// fsck.c computes the same sum.
+static uint
+logsum(void)
+{
+  uint sum, *w;
+  int i, j;
+
+  sum = 2166136261U;
+  for (i = 0; i < log.clh.n; i++) {
+    sum = (sum ^ log.clh.block[i]) * 16777619;
+    w = (uint*)lbuf[i]->data;
+    for (j = 0; j < BSIZE/sizeof(uint); j++)
+      sum = (sum ^ w[j]) * 16777619;
+  }
+  return sum;
+}
+
 static void
 recover_from_log(void)
 {
+  int tail;
+
   read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
+  for (tail = 0; tail < log.clh.n; tail++) {
+    acquiresleep(&lbuf[tail]->lock);
+    lbuf[tail]->blockno = log.start+tail+1;
+    lbuf[tail]->flags = 0;
+    idesubmit(lbuf[tail]);  // read log block
+  }
+  for (tail = 0; tail < log.clh.n; tail++)
+    ideawait(lbuf[tail]);
+  if (logsum() == log.clh.cksum) {
+    install_trans(); // if committed, copy from log to disk
+  } else {
+    cprintf("log: discarding torn commit of %d blocks\n", log.clh.n);
+    log.ntorn++;
+  }
+  for (tail = 0; tail < log.clh.n; tail++)
+    releasesleep(&lbuf[tail]->lock);
+  log.clh.n = 0;
   write_head(); // clear the log
 }
 
@@ -127,13 +235,14 @@ begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.copying){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > log.size){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.nops += 1;
       release(&log.lock);
       break;
     }
@@ -145,62 +254,141 @@ begin_op(void)
 void
 end_op(void)
 {
-  int do_commit = 0;
+  uint ticks0;
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+  // begin_op() may be waiting for log space,
+  // and decrementing log.outstanding has decreased
+  // the amount of reserved space.
+  wakeup(&log);
+
+  // Give other FS sys calls a chance to join the transaction
+  // if the last commit was shared; whoever joins commits.
+  if(log.outstanding == 0 && !log.committing && log.lastnops > 1){
+    ticks0 = ticks;
+    while(log.outstanding == 0 && !log.committing &&
+          ticks - ticks0 < LOGWINDOW &&
+          log.lh.n + MAXOPBLOCKS <= log.size){
+      acquire(&tickslock);
+      if(ticks0 + LOGWINDOW < tickdeadline)
+        tickdeadline = ticks0 + LOGWINDOW;
+      release(&tickslock);
+      sleep(&ticks, &log.lock);
+    }
   }
-  release(&log.lock);
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+  // An active op's end_op(), or the running commit, will
+  // commit the transaction.
+  if(log.outstanding > 0 || log.committing){
     release(&log.lock);
+    return;
   }
+
+  log.committing = 1;
+  while(log.outstanding == 0 && log.lh.n > 0)
+    commit();
+  if(log.lh.n == 0)
+    log.nops = 0;
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to the commit buffers.
 static void
-write_log(void)
+copy_log(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+  for (tail = 0; tail < log.clh.n; tail++) {
+    struct buf *from = bread(log.dev, log.clh.block[tail]); // cache block
+    acquiresleep(&lbuf[tail]->lock);
+    memmove(lbuf[tail]->data, from->data, BSIZE);
     brelse(from);
-    brelse(to);
   }
 }
 
+// Write the commit buffers and the header to the log.
+// This is the true point at which the
+// current transaction commits.
 static void
-commit()
+write_log(void)
+{
+  int tail;
+
+  log.clh.cksum = logsum();
+  cbuf[0] = bread(log.dev, log.start);
+  fill_head(cbuf[0]);
+  for (tail = 0; tail < log.clh.n; tail++) {
+    lbuf[tail]->blockno = log.start+tail+1;
+    cbuf[tail+1] = lbuf[tail];
+  }
+#ifdef LOGCRASH
+  logcrash();
+#endif
+  bwritev(cbuf, log.clh.n+1);  // write the log
+  brelse(cbuf[0]);
+}
+
+// Let the cache evict the installed blocks again, unless
+// the filling transaction has logged them since.
+static void
+unpin(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  int tail, i;
+
+  for (tail = 0; tail < log.clh.n; tail++) {
+    struct buf *b = bread(log.dev, log.clh.block[tail]);
+    acquire(&log.lock);
+    for (i = 0; i < log.lh.n; i++)
+      if (log.lh.block[i] == b->blockno)
+        break;
+    if (i == log.lh.n)
+      b->flags &= ~B_DIRTY;
+    release(&log.lock);
+    brelse(b);
   }
 }
 
+// Commit the filling transaction.  Called with log.lock held
+// and no FS sys calls active; releases it while writing.
+static void
+commit()
+{
+  int tail;
+
+  // Take the transaction and keep new FS sys calls from
+  // changing its blocks until they are copied.
+  log.clh = log.lh;
+  log.lh.n = 0;
+  log.lastnops = log.nops;
+  log.nops = 0;
+  log.ncommit++;
+  log.ncommitops += log.lastnops;
+  log.copying = 1;
+  release(&log.lock);
+
+  copy_log();      // Copy modified blocks from cache
+  acquire(&log.lock);
+  log.copying = 0;
+  wakeup(&log);
+  release(&log.lock);
+
+  write_log();     // Write the copies and header -- the real commit
+#ifdef LOGCRASH
+  logcrash();
+#endif
+  install_trans(); // Now install writes to home locations
+  unpin();
+  for (tail = 0; tail < log.clh.n; tail++)
+    releasesleep(&lbuf[tail]->lock);
+  log.clh.n = 0;
+  write_head();    // Erase the transaction from the log
+
+  acquire(&log.lock);
+}
+
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache with B_DIRTY.
 // commit()/write_log() will do the disk write.
@@ -215,7 +403,7 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.size)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -232,3 +420,10 @@ log_write(struct buf *b)
   release(&log.lock);
 }
 
+// Print log statistics to the console.
+void
+logstats(void)
+{
+  cprintf("log: %d blocks, %d commits of %d FS calls, %d torn at boot\n",
+          log.size, log.ncommit, log.ncommitops, log.ntorn);
+}
@@ -0,0 +1,77 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// malloc/free speed and heap growth with a window of live
+// objects replaced in random order, for small objects only and
+// with one in eight large.
+// Usage: mallocbench [thousands of operations]
+// Build with KRMALLOC=1 to compare against the plain K&R list.
+
+#define NLIVE 2000
+
+static char *live[NLIVE];
+
+static uint randstate = 1;
+
+static uint
+rand(void)
+{
+  randstate = randstate * 1664525 + 1013904223;
+  return randstate >> 8;
+}
+
+// Run n operations, each freeing a random live object or
+// allocating one in its place, the one in large of them
+// (0: none) between 1 and 16 KB, the rest up to 256 bytes.
+static void
+run(char *what, int n, int large)
+{
+  int i, j, start, ticks;
+  uint size;
+  char *brk;
+
+  brk = sbrk(0);
+  start = uptime();
+  for (i = 0; i < n; i++)
+  {
+    j = rand() % NLIVE;
+    if (live[j])
+    {
+      free(live[j]);
+      live[j] = 0;
+      continue;
+    }
+    if (large && rand() % large == 0)
+      size = 1024 + rand() % (15 * 1024);
+    else
+      size = 8 + rand() % 248;
+    if ((live[j] = malloc(size)) == 0)
+    {
+      printf(1, "mallocbench: out of memory\n");
+      exit();
+    }
+    live[j][0] = live[j][size - 1] = 1;
+  }
+  ticks = uptime() - start;
+  for (j = 0; j < NLIVE; j++)
+  {
+    if (live[j])
+      free(live[j]);
+    live[j] = 0;
+  }
+  printf(1, "%s: %d operations in %d ticks, heap grew %d KB\n",
+         what, n, ticks, (sbrk(0) - brk) / 1024);
+}
+
+int main(int argc, char *argv[])
+{
+  int n = 1000;
+
+  if (argc > 1)
+    n = atoi(argv[1]);
+
+  run("small", n * 1000, 0);
+  run("mixed", n * 1000, 8);
+  exit();
+}
@@ -252,6 +252,49 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the disk block holding file block fbn of din.  The block
+// after the last one mapped is allocated, extending the last extent
+// when it ends at freeblock, as it does while a file is appended.
+uint
+fbmap(struct dinode *din, uint fbn)
+{
+  uint i, x, dind[NINDIRECT], indirect[NINDIRECT];
+
+  for(i = 0; i < NEXTENT && xint(din->ext[i].len) > 0; i++){
+    if(fbn < xint(din->ext[i].len))
+      return xint(din->ext[i].start) + fbn;
+    fbn -= xint(din->ext[i].len);
+  }
+  if(fbn == 0 && xint(din->dind) == 0){
+    if(i > 0 && xint(din->ext[i-1].start) + xint(din->ext[i-1].len) == freeblock){
+      din->ext[i-1].len = xint(xint(din->ext[i-1].len) + 1);
+      return freeblock++;
+    }
+    if(i < NEXTENT){
+      din->ext[i].start = xint(freeblock);
+      din->ext[i].len = xint(1);
+      return freeblock++;
+    }
+  }
+
+  assert(fbn < MAXFILE);
+  if(xint(din->dind) == 0){
+    din->dind = xint(freeblock++);
+  }
+  rsect(xint(din->dind), (char*)dind);
+  if(dind[fbn / NINDIRECT] == 0){
+    dind[fbn / NINDIRECT] = xint(freeblock++);
+    wsect(xint(din->dind), (char*)dind);
+  }
+  x = xint(dind[fbn / NINDIRECT]);
+  rsect(x, (char*)indirect);
+  if(indirect[fbn % NINDIRECT] == 0){
+    indirect[fbn % NINDIRECT] = xint(freeblock++);
+    wsect(x, (char*)indirect);
+  }
+  return xint(indirect[fbn % NINDIRECT]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -259,7 +302,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -268,22 +310,7 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = fbmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
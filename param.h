@@ -2,13 +2,22 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
+#define NVMA         16  // memory mappings per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // minimum number of cached i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE     100  // blocks in on-disk log, set by mkfs
+#ifndef NBUF
+#define NBUF       1024  // max size of disk block cache, allocated at boot
+#endif
+#ifndef PIPEPAGES
+#define PIPEPAGES    16  // max pages in a pipe's buffer, a power of 2
+#endif
+#define NREADAHEAD   32  // max blocks read ahead of a sequential reader
+#define FSSIZE      20000  // size of file system in blocks
+#define NQUEUE        5  // number of MLFQ priority levels
+#define NPRIO       101  // PBS priorities are 0..NPRIO-1
 
@@ -0,0 +1,189 @@
+// Program text page cache.
+//
+// exec() maps programs lazily (see vmafault), and every process
+// running the same binary would otherwise read and hold its own
+// copy of each text page.  The pcache keeps page-sized runs of
+// program files, keyed by (dev, inum, offset of the run's first
+// byte), which need not be page- or block-aligned since
+// segments start at their ELF file offset, and vmafault()
+// maps the cached page copy-on-write into each process that runs
+// the program, taking a page reference per mapping (see kincref),
+// so identical processes share their text and a re-exec finds it
+// in memory.  A process that writes such a page, e.g. initialized
+// data, gets a private copy from cowcopy().
+//
+// Entries are hashed by (dev, inum) into NPHASH chains through
+// hnext, so all of a file's pages are on one chain, and recycled
+// in least-recently-used order through prev/next.  Recycling an
+// entry only drops the cache's reference; processes still mapping
+// the page keep it.  writei() and itrunc() drop a file's pages
+// so that later execs see the new contents; processes already
+// running keep the pages they have.  pcache.lock protects the
+// table.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NPCACHE 256
+#define NPHASH   61
+
+struct cpage {
+  uint dev;
+  uint inum;
+  uint off;               // offset in the file of the page's first byte
+  char *page;             // 0 if entry unused
+  struct cpage *hnext;    // hash chain
+  struct cpage *prev;     // LRU list
+  struct cpage *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct cpage cpage[NPCACHE];
+  struct cpage *hash[NPHASH];
+
+  // Linked list of all entries, through prev/next.
+  // head.next is most recently used.
+  struct cpage head;
+  int npage;
+  uint hits;
+  uint misses;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  struct cpage *c;
+
+  initlock(&pcache.lock, "pcache");
+  pcache.head.prev = &pcache.head;
+  pcache.head.next = &pcache.head;
+  for(c = pcache.cpage; c < pcache.cpage+NPCACHE; c++){
+    c->next = pcache.head.next;
+    c->prev = &pcache.head;
+    pcache.head.next->prev = c;
+    pcache.head.next = c;
+  }
+}
+
+static struct cpage**
+phash(uint dev, uint inum)
+{
+  return &pcache.hash[(dev * 31 + inum) % NPHASH];
+}
+
+// Move c to the head (used) or tail (free) of the LRU list.
+// Caller holds pcache.lock.
+static void
+pmove(struct cpage *c, int used)
+{
+  c->next->prev = c->prev;
+  c->prev->next = c->next;
+  if(used){
+    c->next = pcache.head.next;
+    c->prev = &pcache.head;
+  } else {
+    c->next = &pcache.head;
+    c->prev = pcache.head.prev;
+  }
+  c->next->prev = c;
+  c->prev->next = c;
+}
+
+// Take c out of its hash chain and drop its page.
+// Caller holds pcache.lock.
+static void
+pdrop(struct cpage *c)
+{
+  struct cpage **pp;
+
+  for(pp = phash(c->dev, c->inum); *pp; pp = &(*pp)->hnext){
+    if(*pp == c){
+      *pp = c->hnext;
+      break;
+    }
+  }
+  kfree(c->page);
+  c->page = 0;
+  pcache.npage--;
+  pmove(c, 0);
+}
+
+// Return the page holding bytes [off, off+PGSIZE) of ip, which
+// must all be in the file, reading it in if it is not cached.
+// The caller gets a reference to map; 0 if out of memory.
+// Caller holds ip->lock, so only one process reads a page in.
+char*
+pcacheget(struct inode *ip, uint off)
+{
+  struct cpage *c;
+  char *mem;
+
+  acquire(&pcache.lock);
+  for(c = *phash(ip->dev, ip->inum); c; c = c->hnext){
+    if(c->dev == ip->dev && c->inum == ip->inum && c->off == off){
+      kincref(c->page);
+      pmove(c, 1);
+      pcache.hits++;
+      release(&pcache.lock);
+      return c->page;
+    }
+  }
+  pcache.misses++;
+  release(&pcache.lock);
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  iprefetch(ip, off/BSIZE, 2*PGSIZE/BSIZE);
+  if(readi(ip, mem, off, PGSIZE) != PGSIZE){
+    kfree(mem);
+    return 0;
+  }
+
+  // Recycle the least recently used entry.
+  acquire(&pcache.lock);
+  c = pcache.head.prev;
+  if(c->page)
+    pdrop(c);
+  c->dev = ip->dev;
+  c->inum = ip->inum;
+  c->off = off;
+  c->page = mem;
+  c->hnext = *phash(ip->dev, ip->inum);
+  *phash(ip->dev, ip->inum) = c;
+  pcache.npage++;
+  pmove(c, 1);
+  kincref(mem);
+  release(&pcache.lock);
+  return mem;
+}
+
+// Forget the pages of a file that is being written or freed.
+// Caller holds its inode lock.
+void
+pcacheinval(uint dev, uint inum)
+{
+  struct cpage *c, *next;
+
+  acquire(&pcache.lock);
+  for(c = *phash(dev, inum); c; c = next){
+    next = c->hnext;
+    if(c->dev == dev && c->inum == inum)
+      pdrop(c);
+  }
+  release(&pcache.lock);
+}
+
+// Print text page cache statistics to the console.
+void
+pcachestats(void)
+{
+  cprintf("pcache: %d pages, %d hits %d misses\n",
+          pcache.npage, pcache.hits, pcache.misses);
+}
@@ -8,11 +8,20 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+#if PIPEPAGES & (PIPEPAGES-1)
+#error PIPEPAGES must be a power of 2
+#endif
 
+// The buffer is a ring of size bytes kept in separate pages,
+// starting at one page and doubling, up to PIPEPAGES, each time
+// a writer finds it full, so a pipe that is kept busy holds more
+// data between context switches.  Readers sleep only when the
+// pipe is empty and writers only when it is full, so each side
+// wakes the other only when it moves the pipe off those states.
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEPAGES];  // the buffer, PGSIZE bytes each
+  uint size;      // bytes in the buffer
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
@@ -30,6 +39,10 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(p, 0, sizeof(*p));
+  if((p->page[0] = kalloc()) == 0)
+    goto bad;
+  p->size = PGSIZE;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
@@ -47,8 +60,11 @@ pipealloc(struct file **f0, struct file **f1)
 
 //PAGEBREAK: 20
  bad:
-  if(p)
+  if(p){
+    if(p->page[0])
+      kfree(p->page[0]);
     kfree((char*)p);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -59,6 +75,8 @@ pipealloc(struct file **f0, struct file **f1)
 void
 pipeclose(struct pipe *p, int writable)
 {
+  int i;
+
   acquire(&p->lock);
   if(writable){
     p->writeopen = 0;
@@ -69,30 +87,98 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
+    for(i = 0; i < p->size / PGSIZE; i++)
+      kfree(p->page[i]);
     kfree((char*)p);
   } else
     release(&p->lock);
 }
 
+// Copy n bytes between the buffer at offset off and addr, one
+// memmove per page of buffer: into the buffer if in is set,
+// else out of it.  Caller holds p->lock.
+static void
+pipecopy(struct pipe *p, uint off, char *addr, uint n, int in)
+{
+  uint o, m;
+  char *d;
+
+  while(n > 0){
+    o = off % p->size;
+    m = PGSIZE - o % PGSIZE;
+    if(m > n)
+      m = n;
+    d = p->page[o / PGSIZE] + o % PGSIZE;
+    if(in)
+      memmove(d, addr, m);
+    else
+      memmove(addr, d, m);
+    off += m;
+    addr += m;
+    n -= m;
+  }
+}
+
+// Double the full buffer by adding as many new pages after
+// its last one, rotating the page array so that the data starts
+// in page 0 and runs on into the new pages.  Only the data's
+// last bytes, which share the first page with its start when
+// nread is not page-aligned, are copied.  Returns 0, or -1 if
+// it is at PIPEPAGES or out of memory.  Caller holds p->lock.
+static int
+pipegrow(struct pipe *p)
+{
+  char *page[2*PIPEPAGES];
+  uint i, k, r, npage;
+
+  npage = p->size / PGSIZE;
+  if(npage == PIPEPAGES)
+    return -1;
+  for(i = 0; i < npage; i++){
+    if((page[npage+i] = kalloc()) == 0){
+      while(i > 0)
+        kfree(page[npage + --i]);
+      return -1;
+    }
+  }
+  k = p->nread % p->size / PGSIZE;
+  r = p->nread % PGSIZE;
+  for(i = 0; i < npage; i++)
+    page[i] = p->page[(k + i) % npage];
+  if(r > 0)
+    memmove(page[npage], page[0], r);
+  memmove(p->page, page, 2*npage*sizeof(page[0]));
+  p->size *= 2;
+  p->nread = r;
+  p->nwrite = r + p->size / 2;
+  return 0;
+}
+
 //PAGEBREAK: 40
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, m;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+  for(i = 0; i < n; i += m){
+    while(p->nwrite == p->nread + p->size){  //DOC: pipewrite-full
       if(p->readopen == 0 || myproc()->killed){
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
+      if(pipegrow(p) == 0)
+        break;
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    m = p->size - (p->nwrite - p->nread);
+    if(m > n - i)
+      m = n - i;
+    if(p->nwrite == p->nread)
+      wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+    pipecopy(p, p->nwrite, addr + i, m, 1);
+    p->nwrite += m;
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
   return n;
 }
@@ -100,7 +186,7 @@ pipewrite(struct pipe *p, char *addr, int n)
 int
 piperead(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int m;
 
   acquire(&p->lock);
   while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
@@ -110,12 +196,61 @@ piperead(struct pipe *p, char *addr, int n)
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
+  m = p->nwrite - p->nread;  //DOC: piperead-copy
+  if(m > n)
+    m = n;
+  if(p->nwrite == p->nread + p->size)
+    wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  pipecopy(p, p->nread, addr, m, 0);
+  p->nread += m;
+  release(&p->lock);
+  return m;
+}
+
+// Wait until p has room for a writer, growing it if it is full,
+// without taking anything else.  Returns the free bytes, or -1
+// if the read side is closed.  For splice(), which must not
+// sleep here while holding an inode or buffer.
+int
+pipewaitroom(struct pipe *p)
+{
+  int room;
+
+  acquire(&p->lock);
+  while(p->nwrite == p->nread + p->size){
+    if(p->readopen == 0 || myproc()->killed){
+      release(&p->lock);
+      return -1;
+    }
+    if(pipegrow(p) == 0)
       break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+    sleep(&p->nwrite, &p->lock);
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  room = p->size - (p->nwrite - p->nread);
+  release(&p->lock);
+  return room;
+}
+
+// Copy up to n bytes from kernel memory at addr into p, as much
+// as fits without sleeping.  Returns the bytes copied, or -1 if
+// the read side is closed.
+int
+pipeput(struct pipe *p, char *addr, int n)
+{
+  int m;
+
+  acquire(&p->lock);
+  if(p->readopen == 0){
+    release(&p->lock);
+    return -1;
+  }
+  m = p->size - (p->nwrite - p->nread);
+  if(m > n)
+    m = n;
+  if(m > 0 && p->nwrite == p->nread)
+    wakeup(&p->nread);
+  pipecopy(p, p->nwrite, addr, m, 1);
+  p->nwrite += m;
   release(&p->lock);
-  return i;
+  return m;
 }
@@ -0,0 +1,72 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// Pipe throughput between two processes for several write and
+// read sizes.
+// Usage: pipebench [megabytes]
+// Build the kernel with PIPEPAGES=1 to compare against a pipe
+// that stays one page.
+
+#define MAXCHUNK 65536
+
+static char buf[MAXCHUNK];
+
+// Print n bytes in t ticks as MB/s with one decimal.
+static void
+rate(int n, int t)
+{
+  int kbs;
+
+  if (t == 0)
+    t = 1;
+  kbs = n / 1024 * 100 / t;  // 100 ticks a second
+  printf(1, "%d.%d MB/s", kbs / 1024, kbs % 1024 * 10 / 1024);
+}
+
+int main(int argc, char *argv[])
+{
+  static int sizes[] = { 512, 4096, 16384, MAXCHUNK };
+  int mb = 8;
+  int i, n, pid, fds[2], tot, start, ticks;
+
+  if (argc > 1)
+    mb = atoi(argv[1]);
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    if (pipe(fds) < 0)
+    {
+      printf(1, "pipebench: pipe failed\n");
+      exit();
+    }
+    start = uptime();
+    pid = fork();
+    if (pid < 0)
+    {
+      printf(1, "pipebench: fork failed\n");
+      exit();
+    }
+    if (pid == 0)
+    {
+      close(fds[0]);
+      for (tot = 0; tot < mb * 1024 * 1024; tot += sizes[i])
+        if (write(fds[1], buf, sizes[i]) != sizes[i])
+          break;
+      close(fds[1]);
+      exit();
+    }
+    close(fds[1]);
+    tot = 0;
+    while ((n = read(fds[0], buf, sizes[i])) > 0)
+      tot += n;
+    close(fds[0]);
+    wait();
+    ticks = uptime() - start;
+
+    printf(1, "%d MB in %d byte writes and reads: %d ticks, ", mb, sizes[i], ticks);
+    rate(tot, ticks);
+    printf(1, "\n");
+  }
+  exit();
+}
@@ -1,11 +1,139 @@
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "param.h"
+
+// Buffered output.
+//
+// printf() and fwrite() collect output in a buffer per file
+// descriptor rather than making a write() system call for every
+// character.  The console is line buffered: its buffer is written
+// out at each newline.  Files and pipes are fully buffered and
+// written out when the buffer fills.  Descriptor 2 is written out
+// at the end of every call, so error messages appear at once.
+// fflush() writes a buffer out explicitly, and the write, fork,
+// exec, close and exit wrappers in ulib.c write out pending
+// output first (see ioflush), so it is neither lost, written
+// twice, nor overtaken by a direct write().
+// Build with UNBUFFERED=1 to write a character at a time.
+
+#ifndef UNBUFFERED
+
+#define OBSIZE 512
+
+enum { UNSET, UNBUF, LINEBUF, FULLBUF };
+
+struct obuf {
+  int mode;
+  int n;                  // bytes in buf
+  int nl;                 // buf holds a newline
+  char buf[OBSIZE];
+};
+
+static struct obuf obuf[NOFILE];
+
+// Write out fd's buffer.  Returns -1 if the write failed.
+static int
+bflush(int fd, struct obuf *b)
+{
+  int n;
+
+  n = b->n;
+  b->n = 0;
+  b->nl = 0;
+  if(n > 0 && _write(fd, b->buf, n) != n)
+    return -1;
+  return 0;
+}
+
+// The ioflush hook (see ulib.c).
+static void
+obflush(int fd, int closing)
+{
+  if(fd >= 0){
+    if(fd < NOFILE && obuf[fd].mode != UNSET){
+      bflush(fd, &obuf[fd]);
+      if(closing)
+        obuf[fd].mode = UNSET;
+    }
+    return;
+  }
+  for(fd = 0; fd < NOFILE; fd++)
+    if(obuf[fd].mode != UNSET)
+      bflush(fd, &obuf[fd]);
+}
+
+// Return fd's buffer, picking its buffering on first use.
+static struct obuf*
+getbuf(int fd)
+{
+  struct obuf *b;
+  struct stat st;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  b = &obuf[fd];
+  if(b->mode == UNSET){
+    if(fd == 2)
+      b->mode = UNBUF;
+    else if(fstat(fd, &st) >= 0 && st.type == T_DEV)
+      b->mode = LINEBUF;
+    else
+      b->mode = FULLBUF;
+    b->n = 0;
+    b->nl = 0;
+    ioflush = obflush;
+  }
+  return b;
+}
+
+// Append n bytes to fd's buffer.  Returns n, or -1 if
+// writing out a full buffer failed.
+static int
+bput(int fd, const char *p, int n)
+{
+  struct obuf *b;
+  int i;
+
+  if((b = getbuf(fd)) == 0)
+    return _write(fd, p, n);
+  if(b->n == 0 && n >= OBSIZE)
+    return _write(fd, p, n);  // nothing to gain from copying
+  for(i = 0; i < n; i++){
+    if(b->n == OBSIZE && bflush(fd, b) < 0)
+      return -1;
+    b->buf[b->n++] = p[i];
+    if(p[i] == '\n')
+      b->nl = 1;
+  }
+  return n;
+}
+
+// End of a printf() or fwrite() call: write out fd's buffer
+// if its buffering says so.
+static int
+bdone(int fd)
+{
+  struct obuf *b;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  b = &obuf[fd];
+  if(b->mode == UNBUF || (b->mode == LINEBUF && b->nl))
+    return bflush(fd, b);
+  return 0;
+}
+
+#endif
 
 static void
 putc(int fd, char c)
 {
+#ifdef UNBUFFERED
   write(fd, &c, 1);
+#else
+  bput(fd, &c, 1);
+#endif
 }
 
 static void
@@ -82,4 +210,31 @@ printf(int fd, const char *fmt, ...)
       state = 0;
     }
   }
+#ifndef UNBUFFERED
+  bdone(fd);
+#endif
+}
+
+// Write n bytes to fd through its buffer.
+// Returns n, or -1 if a write failed.
+int
+fwrite(int fd, const void *p, int n)
+{
+#ifdef UNBUFFERED
+  return write(fd, p, n);
+#else
+  if(bput(fd, p, n) < 0 || bdone(fd) < 0)
+    return -1;
+  return n;
+#endif
+}
+
+// Write out the output buffered for fd, or for all
+// descriptors if fd is -1.
+void
+fflush(int fd)
+{
+#ifndef UNBUFFERED
+  obflush(fd, 0);
+#endif
 }
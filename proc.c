@@ -6,6 +6,7 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "traps.h"
 #define AGE 20
 
 struct {
@@ -14,8 +15,46 @@ struct {
 } ptable;
 
 // for MLFQ
-int q_size[5] = {-1, -1, -1, -1, -1};   // gives no of processes in each queue (0 index-based)
-int q_ticks_max[5] = {1, 2, 4, 8, 16};  // max time slice in each queue
+int q_ticks_max[NQUEUE] = {1, 2, 4, 8, 16};  // max time slice in each queue
+
+// Per-CPU run queues.  Every RUNNABLE process that is not about
+// to be run is linked into exactly one of them; rq->lock protects
+// the lists and the RUNNABLE -> RUNNING transition of the processes
+// on them.  Each level is a FIFO list threaded through
+// p->qnext/p->qprev and bit i of mask is set iff level i is
+// nonempty.  MLFQ uses one level per queue and PBS one level per
+// priority, so the first set bit is the best runnable process;
+// RR and FCFS only use level 0.
+//
+// A process switches out (see sched) holding its CPU's rq->lock,
+// plus ptable.lock if it is sleeping or exiting; the scheduler
+// releases them once it is back on its own stack.  A process is
+// switched in with the new CPU's rq->lock held and releases it.
+// Lock order: ptable.lock before any rq->lock, and at most one
+// rq->lock at a time.
+#if defined(MLFQ)
+#define NRQLEVEL NQUEUE
+#elif defined(PBS)
+#define NRQLEVEL NPRIO
+#else
+#define NRQLEVEL 1
+#endif
+
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NRQLEVEL];
+  struct proc *tail[NRQLEVEL];
+  uint mask[(NRQLEVEL+31)/32];
+  int nrun;                    // number of queued processes
+  uint agedue;                 // MLFQ: no head of levels 1.. ages before this
+} runqs[NCPU];
+
+// Bit i is set while CPU i is halted in idle() with
+// nothing to run.
+volatile uint idlecpus;
+
+// Longest a tickless CPU0 stays halted without a deadline.
+#define MAXTICKLESS 100
 
 static struct proc *initproc;
 
@@ -24,11 +63,27 @@ extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static void rq_add(struct proc*);
+static void rq_kick(struct runq*);
+static void idle(void);
+static int rq_level(struct proc*);
+static int rq_first(struct runq*);
+static void rq_remove(struct runq*, struct proc*);
+static void rq_push(struct runq*, struct proc*);
+static struct proc* rq_pick(struct runq*);
+static struct proc* rq_steal(struct runq*);
+#ifdef MLFQ
+static void rq_age(struct runq*);
+#endif
 
 void
 pinit(void)
 {
+  struct runq *rq;
+
   initlock(&ptable.lock, "ptable");
+  for(rq = runqs; rq < &runqs[NCPU]; rq++)
+    initlock(&rq->lock, "runq");
 }
 
 // Must be called with interrupts disabled
@@ -99,6 +154,7 @@ found:
   p->rtime = 0;
   p->etime = 0;
   p->wtime = 0;
+  p->tstamp = ticks;
   /* Default priority */
   p->priority = 60;
 
@@ -106,9 +162,13 @@ found:
   for (int i = 0; i < 5; i++)
     p->ticks[i]=0;
   p->n_run = 0;
+  p->nsyscall = 0;
   p->curr_queue = 0;
   p->curr_ticks = 0;
   p->enter = 0;
+  p->change_q = 0;
+  p->qnext = p->qprev = 0;
+  p->rq = 0;
 
   release(&ptable.lock);
 
@@ -170,10 +230,8 @@ userinit(void)
   acquire(&ptable.lock);
 
   p->state = RUNNABLE;
-
-  #ifdef MLFQ
-  shift_proc_q(p,-1,0); // add proc to queue 0
-  #endif
+  p->cpu = cpuid();
+  rq_add(p);
 
   release(&ptable.lock);
 }
@@ -188,8 +246,11 @@ growproc(int n)
 
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Only reserve the address space; pagefault() fills in
+    // pages as they are touched.
+    if(sz + n < sz || sz + n > vmabase(curproc))
       return -1;
+    sz += n;
   } else if(n < 0){
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
@@ -215,7 +276,19 @@ fork(void)
   }
 
   // Copy process state from proc.
+#ifdef NOCOW
   if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+#else
+  if((np->pgdir = cowuvm(curproc->pgdir, curproc->sz)) == 0){
+#endif
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  if(vmacopy(np, curproc) < 0){
+    freevm(np->pgdir);
+    np->pgdir = 0;
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
@@ -240,9 +313,8 @@ fork(void)
   acquire(&ptable.lock);
 
   np->state = RUNNABLE;
-  #ifdef MLFQ
-  shift_proc_q(np,-1,0);
-  #endif
+  np->cpu = cpuid();
+  rq_add(np);
 
   release(&ptable.lock);
 
@@ -262,6 +334,9 @@ exit(void)
   if(curproc == initproc)
     panic("init exiting");
 
+  // Write back shared mappings while their files are open.
+  vmaclear(curproc);
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(curproc->ofile[fd]){
@@ -292,6 +367,7 @@ exit(void)
   // Jump into the scheduler, never to return.
   curproc->state = ZOMBIE;
   curproc->etime = ticks;
+  acquire(&runqs[cpuid()].lock);
   sched();
   panic("zombie exit");
 }
@@ -319,9 +395,7 @@ wait(void)
         kfree(p->kstack);
         p->kstack = 0;
         freevm(p->pgdir);
-        #ifdef MLFQ
-        shift_proc_q(p,p->curr_queue,-1); // remove proc from curr_queue
-        #endif
+        p->pgdir = 0;
         p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
@@ -363,9 +437,7 @@ int waitx(int *wtime, int *rtime)
         kfree(p->kstack);
         p->kstack = 0;
         freevm(p->pgdir);
-        #ifdef MLFQ
-        shift_proc_q(p,p->curr_queue,-1); // remove proc from curr_queue
-        #endif
+        p->pgdir = 0;
         p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
@@ -397,206 +469,90 @@ int waitx(int *wtime, int *rtime)
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run
+//  - choose a process to run from this CPU's run queue,
+//    or steal one from the busiest other CPU
 //  - swtch to start running that process
 //  - eventually that process transfers control
 //      via swtch back to the scheduler.
 void
 scheduler(void)
 {
-  struct proc *p=0;
+  struct proc *p;
   struct cpu *c = mycpu();
+  struct runq *rq = &runqs[c-cpus];
   c->proc = 0;
-  
-  #ifdef RR
-    for(;;){
-      // Enable interrupts on this processor.
-      sti();
-
-      // Loop over process table looking for process to run.
-      acquire(&ptable.lock);
-      for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-        if(p->state != RUNNABLE)
-          continue;
-
-        // Switch to chosen process.  It is the process's job
-        // to release ptable.lock and then reacquire it
-        // before jumping back to us.
-        c->proc = p;
-        switchuvm(p);
-        p->state = RUNNING;
-
-        swtch(&(c->scheduler), p->context);
-        switchkvm();
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&ptable.lock);
-    }
-  #else
-  #ifdef FCFS
-    for(;;){
-      // Enable interrupts on this processor.
-      sti();
-      struct proc* min_time_proc=0; //process with min creation time
-
-      // Loop over process table looking for process to run.
-      acquire(&ptable.lock);
-      for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-        if(p->state != RUNNABLE)
-          continue;
-
-        if (min_time_proc==0) 
-          min_time_proc = p;
-        else if (min_time_proc->ctime > p->ctime) 
-          min_time_proc = p;
-      }
-
-      if (min_time_proc!=0)
-      {
-        // Switch to chosen process.  It is the process's job
-        // to release ptable.lock and then reacquire it
-        // before jumping back to us.
-        c->proc = min_time_proc;
-        switchuvm(min_time_proc);
-        min_time_proc->state = RUNNING;
-
-        swtch(&(c->scheduler), min_time_proc->context);
-        switchkvm();
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&ptable.lock);
-    }
-  #else
-  #ifdef PBS
-    for(;;){
-      // Enable interrupts on this processor.
-      sti();
-
-      struct proc* min_priority_proc = 0;
-      // Loop over process table looking for process to run.
-      acquire(&ptable.lock);
-      for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-      {
-        if(p->state != RUNNABLE)
-          continue;
 
-        min_priority_proc = p;
-        // extra loop because for same priority process round robin
-        for (struct proc *itr = ptable.proc; itr < &ptable.proc[NPROC]; itr++)
-        {
-          if(itr->state != RUNNABLE) 
-            continue;
-          if(itr->priority < min_priority_proc->priority)
-            min_priority_proc = itr;
-        }
-        if (min_priority_proc != 0)
-        {
-          p = min_priority_proc;
-          // Switch to chosen process.  It is the process's job
-          // to release ptable.lock and then reacquire it
-          // before jumping back to us.
-          c->proc = p;
-          switchuvm(p);
-          p->state = RUNNING;
-
-          swtch(&(c->scheduler), p->context);
-          switchkvm();
-
-          // Process is done running for now.
-          // It should have changed its p->state before coming back.
-          c->proc = 0;
-        }
+  for(;;){
+    // Enable interrupts on this processor.
+    sti();
+
+    acquire(&rq->lock);
+    #ifdef MLFQ
+    rq_age(rq);
+    #endif
+    if((p = rq_pick(rq)) == 0){
+      release(&rq->lock);
+      if((p = rq_steal(rq)) == 0){
+        idle();
+        continue;
       }
-      release(&ptable.lock);
+      acquire(&rq->lock);
     }
-  #else
-  #ifdef MLFQ
-    for(;;){
-      // Enable interrupts on this processor.
-      sti();
 
-      // Loop over process table looking for process to run.
-      acquire(&ptable.lock);
-
-      // AGING
-      for (int i = 1; i <= 4; i++)
-      {
-        for (int j = 0; j <= q_size[i]; j++)
-        {
-          int age = ticks - queue[i][j]->enter;
-          if (age > AGE)
-            shift_proc_q(queue[i][j],i,i-1);  // shift from i queue i-1 queue
-        }
-      }
-      
-      for (int i = 0; i <= 4; i++)
-      {
-        if (q_size[i]>=0)
-        {
-          p = queue[i][0];
-          shift_proc_q(p,i,-1);
-          break;
-        }
-      }
-      if(p!=0 && p->state == RUNNABLE)
-      {
-        // if(p->state != RUNNABLE)
-        //   continue;
-        // cprintf("bitch run please!\n");
-
-        p->curr_ticks++;
-        p->n_run++;
-        p->ticks[p->curr_queue]++;
-
-        // Switch to chosen process.  It is the process's job
-        // to release ptable.lock and then reacquire it
-        // before jumping back to us.
-        c->proc = p;
-        switchuvm(p);
-        p->state = RUNNING;
-
-        swtch(&(c->scheduler), p->context);
-        switchkvm();
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-
-        // TIME SLICE OF PROCESS FINISHED = shift lower priority queue
-        if (p!=0 && p->state == RUNNABLE)
-        {
-        // cprintf("bitch run please!\n");
-        // cprintf("%d\n",p->pid);
-          p->curr_ticks = 0;
-          
-          if (p->change_q == 1) 
-          {
-            p->change_q = 0;
-            if (p->curr_queue < 4) 
-            {
-              shift_proc_q(p,p->curr_queue,(p->curr_queue)+1);
-              p->curr_queue++;
-            }
-          }
-          else
-            shift_proc_q(p,p->curr_queue,p->curr_queue); // add process to same queue
-        }
+    #ifdef MLFQ
+    p->curr_ticks++;
+    p->n_run++;
+    p->ticks[p->curr_queue]++;
+    #endif
+    p->wtime += ticks - p->tstamp;
+    p->tstamp = ticks;
+
+    // Switch to chosen process.  It is the process's job
+    // to release rq->lock and then reacquire it
+    // before jumping back to us.
+    c->proc = p;
+    p->cpu = c-cpus;
+    switchuvm(p);
+    p->state = RUNNING;
+
+    swtch(&(c->scheduler), p->context);
+    switchkvm();
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    p->rtime += ticks - p->tstamp;
+    #ifdef MLFQ
+    p->ticks[p->curr_queue] += ticks - p->tstamp;
+    #endif
+    p->tstamp = ticks;
+
+    if(p->state == RUNNABLE){
+      // Preempted or yielded: back on this CPU's queue.
+      #ifdef MLFQ
+      // One level lower if the time slice of its queue was used up.
+      p->curr_ticks = 0;
+      if(p->change_q == 1){
+        p->change_q = 0;
+        if(p->curr_queue < NQUEUE-1)
+          p->curr_queue++;
       }
+      #endif
+      rq_push(rq, p);
+      // More queued than this CPU is about to run: let an
+      // idle CPU steal some.
+      if(rq->nrun > 1)
+        rq_kick(rq);
+    } else {
+      // Sleeping or exiting: it also handed us ptable.lock.
       release(&ptable.lock);
     }
-  #endif
-  #endif
-  #endif
-  #endif
+    release(&rq->lock);
+  }
 }
 
-// Enter scheduler.  Must hold only ptable.lock
+// Enter scheduler.  Must hold this CPU's rq->lock, and
+// ptable.lock as well unless proc->state is RUNNABLE,
 // and have changed proc->state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
@@ -609,9 +565,11 @@ sched(void)
   int intena;
   struct proc *p = myproc();
 
-  if(!holding(&ptable.lock))
+  if(!holding(&runqs[cpuid()].lock))
+    panic("sched rq->lock");
+  if(p->state != RUNNABLE && !holding(&ptable.lock))
     panic("sched ptable.lock");
-  if(mycpu()->ncli != 1)
+  if(mycpu()->ncli != (p->state == RUNNABLE ? 1 : 2))
     panic("sched locks");
   if(p->state == RUNNING)
     panic("sched running");
@@ -626,10 +584,12 @@ sched(void)
 void
 yield(void)
 {
-  acquire(&ptable.lock);  //DOC: yieldlock
+  pushcli();
+  acquire(&runqs[cpuid()].lock);  //DOC: yieldlock
+  popcli();
   myproc()->state = RUNNABLE;
   sched();
-  release(&ptable.lock);
+  release(&runqs[cpuid()].lock);
 }
 
 // A fork child's very first scheduling by scheduler()
@@ -638,16 +598,18 @@ void
 forkret(void)
 {
   static int first = 1;
-  // Still holding ptable.lock from scheduler.
-  release(&ptable.lock);
+  // Still holding rq->lock from scheduler.
+  release(&runqs[cpuid()].lock);
 
   if (first) {
     // Some initialization functions must be run in the context
     // of a regular process (e.g., they call sleep), and thus cannot
     // be run from main().
     first = 0;
-    iinit(ROOTDEV);
+    // Recover the log first: recovery writes blocks straight to
+    // disk, and iinit() caches the bitmap to count free blocks.
     initlog(ROOTDEV);
+    iinit(ROOTDEV);
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -680,16 +642,18 @@ sleep(void *chan, struct spinlock *lk)
   p->chan = chan;
   p->state = SLEEPING;
 
+  acquire(&runqs[cpuid()].lock);
   sched();
 
+  // The scheduler released ptable.lock once we were off
+  // the CPU; we resume holding the new CPU's rq->lock.
+  release(&runqs[cpuid()].lock);
+
   // Tidy up.
   p->chan = 0;
 
   // Reacquire original lock.
-  if(lk != &ptable.lock){  //DOC: sleeplock2
-    release(&ptable.lock);
-    acquire(lk);
-  }
+  acquire(lk);  //DOC: sleeplock2
 }
 
 //PAGEBREAK!
@@ -704,10 +668,11 @@ wakeup1(void *chan)
   {
     if(p->state == SLEEPING && p->chan == chan){
       p->state = RUNNABLE;
+      p->tstamp = ticks;
       #ifdef MLFQ
       p->curr_ticks = 0;
-      shift_proc_q(p,-1,p->curr_queue);
       #endif
+      rq_add(p);
     }
   }
 }
@@ -737,9 +702,8 @@ kill(int pid)
       if(p->state == SLEEPING)
       {
         p->state = RUNNABLE;
-        #ifdef MLFQ
-        shift_proc_q(p,-1,p->curr_queue);
-        #endif
+        p->tstamp = ticks;
+        rq_add(p);
       }
       release(&ptable.lock);
       return 0;
@@ -786,54 +750,69 @@ procdump(void)
   }
 }
 
-void change_time()
+// Run time of p, including the tick count of the current
+// run if p is on a CPU.
+static int
+proc_rtime(struct proc *p)
 {
-  acquire(&ptable.lock);
-	
-  struct proc *p;
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-  {
-  	if(p -> state == RUNNING)
-    {	
-      p -> rtime++;
-      
-      #ifdef MLFQ
-      p -> ticks[p -> curr_queue]++;
-      p -> curr_ticks++;     
-      #endif
-    }
+  if(p->state == RUNNING)
+    return p->rtime + (ticks - p->tstamp);
+  return p->rtime;
+}
 
-  	else
-  	{
-      p->wtime++;	
-      #ifdef MLFQ
-      if(p -> curr_queue != 0 && ticks-p->curr_ticks > AGE) 
-      {
-        // cprintf("Aging for process %d\n", p -> pid);
-        p -> curr_queue--;
-        p -> curr_ticks = 0;
-        p -> wtime = 0;
-        shift_proc_q(p,-1,p->curr_queue);
-      }
-      #endif
-    }  
-  }
+// Time p spent RUNNABLE waiting for a CPU, including
+// the current wait.
+static int
+proc_wtime(struct proc *p)
+{
+  if(p->state == RUNNABLE)
+    return p->wtime + (ticks - p->tstamp);
+  return p->wtime;
+}
 
-  release(&ptable.lock);
+// Ticks p has used of its current MLFQ time slice.
+// Called by the running process itself.
+int
+slice_ticks(struct proc *p)
+{
+  return p->curr_ticks + (ticks - p->tstamp);
 }
 
 int set_priority(int new_priority, int pid)
 {
-  // cprintf("%d %d\n", new_priority, pid);
-  acquire(&ptable.lock);
+  struct runq *rq;
   int old_priority=-1;
 
+  if (new_priority < 0 || new_priority >= NPRIO)
+    return -1;
+
+  acquire(&ptable.lock);
   for (struct proc* p = ptable.proc; p < &ptable.proc[NPROC]; p++)
   {
     if (p->pid == pid)
     {
       old_priority = p->priority;
       p->priority = new_priority;
+      __sync_synchronize();
+
+      // If p is queued, move it to the bucket of its new
+      // priority.  A push racing with the update above
+      // is caught by rechecking p->rq.
+      while ((rq = p->rq) != 0)
+      {
+        acquire(&rq->lock);
+        if (p->rq == rq)
+        {
+          if (p->qlevel != rq_level(p))
+          {
+            rq_remove(rq, p);
+            rq_push(rq, p);
+          }
+          release(&rq->lock);
+          break;
+        }
+        release(&rq->lock);
+      }
       break;
     }
   }
@@ -842,45 +821,25 @@ int set_priority(int new_priority, int pid)
 }
 
 // priority = priority of currently running process
+// Compares it against the best priority waiting on this
+// CPU's run queue.  The queue is read without its lock;
+// the answer is only a hint and is rechecked on the next trap.
 int checkPreempt(int priority, int samePriority)
 {
-  acquire(&ptable.lock);
+  int best;
+
+  pushcli();
+  best = rq_first(&runqs[cpuid()]);
+  popcli();
 
   // Just checking if lower priority process has come into queue
   if (samePriority==0)
-  {
-    for (struct proc* p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    {
-      if (p->pid == 0) 
-        continue;
-      else if (p->priority < priority) 
-      {
-        // process with less priority found
-        release(&ptable.lock);
-        return 1;
-      }
-    }
-  }
+    return best < priority;
 
   // time slice of running process finished
   // check if same (or less) priority process present, if not - do nothing
   // we will apply round robin for same priority processes
-  else
-  {
-    for (struct proc* p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    {
-      if (p->pid == 0) 
-        continue;
-      else if (p->priority <= priority)
-      {
-        release(&ptable.lock);
-        return 1;
-      }  
-    }
-  }
-  
-  release(&ptable.lock);
-  return 0;
+  return best <= priority;
 }
 
 // system call used by ps.c to print all the active process stats
@@ -901,9 +860,26 @@ int printpinfos()
     if (p->state==4) state = "RUNNING";
     else             state = "ZOMBIE";
 
-    cprintf(" %d\t%d\t%s\t%d\t%d\t%d\t%d  |  %d    %d    %d    %d    %d    %d\n",
-    p-> pid, p->priority, state, p->rtime, p->wtime, p->n_run, p->curr_queue,
-    p->ticks[0], p->ticks[1], p->ticks[2], p->ticks[3], p->ticks[4]);
+    int qticks[NQUEUE];
+    for (int i = 0; i < NQUEUE; i++)
+      qticks[i] = p->ticks[i];
+    #ifdef MLFQ
+    if (p->state == RUNNING)
+      qticks[p->curr_queue] += ticks - p->tstamp;
+    #endif
+
+    // Resident vs. reserved memory: sbrk() and mmap() pages
+    // are only allocated when touched.
+    int vsz = 0, rss = 0;
+    if (p->state != EMBRYO && p->pgdir)
+    {
+      vsz = uvmsize(p) / 1024;
+      rss = uvmresident(p->pgdir) * (PGSIZE / 1024);
+    }
+
+    cprintf(" %d\t%d\t%s\t%d\t%d\t%d\t%d\t%d\t%d  |  %d    %d    %d    %d    %d    %d\n",
+    p-> pid, p->priority, state, proc_rtime(p), proc_wtime(p), p->n_run, p->curr_queue,
+    vsz, rss, qticks[0], qticks[1], qticks[2], qticks[3], qticks[4]);
   }
   release(&ptable.lock);
 
@@ -917,85 +893,252 @@ void change_q_flag(struct proc* p)
 	release(&ptable.lock);
 }
 
-void incr_curr_ticks(struct proc *p)
+// Run queue level p belongs on.
+static int
+rq_level(struct proc *p)
 {
-	acquire(&ptable.lock);
-	p->curr_ticks++;
-	p->ticks[p->curr_queue]++;
-	release(&ptable.lock);
+  #if defined(MLFQ)
+  return p->curr_queue;
+  #elif defined(PBS)
+  return p->priority;
+  #else
+  return 0;
+  #endif
 }
 
-// remove from q_i & add in q_f
-// (p,-1,q_f) = add proc in q_f
-// (p,q_i,-1) = remove proc from q_i
-int shift_proc_q(struct proc *p, int q_i, int q_f) 
+// First nonempty level of rq, or NRQLEVEL if rq is empty.
+static int
+rq_first(struct runq *rq)
 {
-  // pop from q_i
-  if (q_f==-1)
-  {
-    int found = -1;
-    for (int i = 0; i <= q_size[q_i]; i++)
-    {
-      if (queue[q_i][i]->pid == p->pid)
-      {
-        found = i;
-        break;
-      }
-    }
-    if (found == -1) return -1;
-    
-    for (int i = found; i < q_size[q_i]; i++)
-      queue[q_i][i] = queue[q_i][i+1];
+  for(int i = 0; i < NELEM(rq->mask); i++)
+    if(rq->mask[i])
+      return i*32 + __builtin_ctz(rq->mask[i]);
+  return NRQLEVEL;
+}
 
-    q_size[q_i]--;    
-    return 1;
-  }
+// Unlink p from rq.  Caller must hold rq->lock.
+static void
+rq_remove(struct runq *rq, struct proc *p)
+{
+  int q = p->qlevel;
 
-  // push into q_f
-  else if (q_i==-1)
-  {
-    for (int i = 0; i <= q_size[q_f]; i++)
-    {
-      if(queue[q_f][i]->pid == p->pid)
-        return -1;
-    }
-    p->enter = ticks;
-    p->curr_queue = q_f;
-    q_size[q_f]++;
-    queue[q_f][q_size[q_f]] = p;
+  if(p->qprev)
+    p->qprev->qnext = p->qnext;
+  else
+    rq->head[q] = p->qnext;
+  if(p->qnext)
+    p->qnext->qprev = p->qprev;
+  else
+    rq->tail[q] = p->qprev;
+  if(rq->head[q] == 0)
+    rq->mask[q/32] &= ~(1 << (q%32));
+  p->qnext = p->qprev = 0;
+  p->rq = 0;
+  rq->nrun--;
+}
 
-    return 1;
-  }
+// Append p to the tail of its level of rq.
+// Caller must hold rq->lock.
+static void
+rq_push(struct runq *rq, struct proc *p)
+{
+  int q;
 
-  // actual shift
-  else 
-  {
-    int found = -1;
-    for (int i = 0; i <= q_size[q_i]; i++)
-    {
-      if (queue[q_i][i] -> pid == p->pid)
-      {
-        found = i;
-        break;
+  #ifndef MLFQ
+  p->curr_queue = 0;
+  #endif
+  q = p->qlevel = rq_level(p);
+  p->enter = ticks;
+  p->qnext = 0;
+  p->qprev = rq->tail[q];
+  if(rq->tail[q])
+    rq->tail[q]->qnext = p;
+  else
+    rq->head[q] = p;
+  rq->tail[q] = p;
+  #ifdef MLFQ
+  // Later pushes never age sooner than the current heads.
+  if(q > 0 && (rq->mask[0] & ~1) == 0)
+    rq->agedue = p->enter + AGE + 1;
+  #endif
+  rq->mask[q/32] |= 1 << (q%32);
+  p->rq = rq;
+  rq->nrun++;
+}
+
+// Queue a process that just became RUNNABLE on the run
+// queue of the CPU it last ran on.
+// Caller must hold ptable.lock.
+static void
+rq_add(struct proc *p)
+{
+  struct runq *rq = &runqs[p->cpu];
+
+  acquire(&rq->lock);
+  rq_push(rq, p);
+  release(&rq->lock);
+  rq_kick(rq);
+}
+
+// Work was just queued on rq: if its CPU is halted, wake
+// it; otherwise wake any halted CPU so that it can steal.
+// Must be called with interrupts disabled.
+static void
+rq_kick(struct runq *rq)
+{
+  uint idle = idlecpus;
+  int i;
+
+  if(idle == 0)
+    return;
+  i = rq - runqs;
+  if((idle & (1 << i)) == 0)
+    i = __builtin_ctz(idle);
+  // A halted CPU running an interrupt handler rechecks
+  // the queues on its own.
+  if(i != cpuid())
+    lapicipi(cpus[i].apicid, T_IRQ0 + IRQ_RESCHED);
+}
+
+// Called by the scheduler when there is nothing to run or
+// steal: halt until an interrupt or a reschedule IPI.  With
+// TICKLESS, other CPUs also stop their timer, and CPU0 stops
+// its periodic tick once every CPU is idle, sleeping until
+// the next sleep() deadline instead.
+static void
+idle(void)
+{
+  struct runq *rq;
+  struct cpu *c;
+  int id;
+
+  cli();
+  c = mycpu();
+  id = c - cpus;
+  // Publish idleness before rechecking the queues; rq_kick()
+  // queues before reading idlecpus, so one of us sees the other.
+  __sync_fetch_and_or(&idlecpus, 1 << id);
+  for(rq = runqs; rq < &runqs[ncpu]; rq++)
+    if(rq->nrun > 0)
+      break;
+  if(rq == &runqs[ncpu]){
+    #ifdef TICKLESS
+    if(id == 0){
+      uint n;
+
+      c->tickless = 1;
+      __sync_synchronize();
+      if(idlecpus == (1 << ncpu) - 1){
+        n = tickdeadline - ticks;
+        if(tickdeadline <= ticks)
+          n = 1;
+        else if(n > MAXTICKLESS)
+          n = MAXTICKLESS;
+        lapiconeshot(n);
+      } else
+        c->tickless = 0;
+    } else
+      lapiconeshot(0);
+    #endif
+
+    stihlt();
+    cli();
+
+    #ifdef TICKLESS
+    if(id == 0){
+      if(c->tickless){
+        c->tickless = 0;
+        tickcatchup(lapicperiodic());
       }
-    }
-    if (found == -1) return -1;
-    
-    for (int i = found; i < q_size[q_i]; i++)
-      queue[q_i][i] = queue[q_i][i+1];
+    } else
+      lapicperiodic();
+    #endif
+  }
+  __sync_fetch_and_and(&idlecpus, ~(1 << id));
+  #ifdef TICKLESS
+  // CPU0 may have stopped the tick thinking we were idle.
+  if(id != 0 && cpus[0].tickless)
+    lapicipi(cpus[0].apicid, T_IRQ0 + IRQ_RESCHED);
+  #endif
+  sti();
+}
+
+// Remove and return the process rq should run next,
+// or 0 if rq is empty.  Caller must hold rq->lock.
+static struct proc*
+rq_pick(struct runq *rq)
+{
+  struct proc *p;
+  int q;
 
-    q_size[q_i]--;    
+  if((q = rq_first(rq)) == NRQLEVEL)
+    return 0;
+  p = rq->head[q];
+  #ifdef FCFS
+  // Earliest created first.
+  for(struct proc *pp = p->qnext; pp; pp = pp->qnext)
+    if(pp->ctime < p->ctime)
+      p = pp;
+  #endif
+  rq_remove(rq, p);
+  return p;
+}
 
-    for (int i = 0; i <= q_size[q_f]; i++)
-    {
-      if(queue[q_f][i]->pid == p->pid)
-        return -1;
-    }
-    p->enter = ticks;
-    p->curr_queue = q_f;
-    q_size[q_f]++;
-    queue[q_f][q_size[q_f]] = p;
+// Called by an idle CPU: take the next process from the
+// run queue of the busiest other CPU, or return 0.
+// Must not hold any rq->lock.
+static struct proc*
+rq_steal(struct runq *self)
+{
+  struct runq *rq, *busiest;
+  struct proc *p;
 
-    return 1;
+  busiest = 0;
+  for(rq = runqs; rq < &runqs[ncpu]; rq++)
+    if(rq != self && rq->nrun > 0 && (busiest == 0 || rq->nrun > busiest->nrun))
+      busiest = rq;
+  if(busiest == 0)
+    return 0;
+
+  acquire(&busiest->lock);
+  p = rq_pick(busiest);
+  release(&busiest->lock);
+  return p;
+}
+
+#ifdef MLFQ
+// Promote processes that have waited more than AGE ticks
+// in queues 1..NQUEUE-1.  Queues are FIFO and p->enter is
+// set on every push, so each head carries the earliest aging
+// deadline of its level, and rq->agedue is a lower bound on
+// all of them: until it passes there is nothing to do.
+// Caller must hold rq->lock.
+static void
+rq_age(struct runq *rq)
+{
+  struct proc *p;
+  uint due;
+
+  if((rq->mask[0] & ~1) == 0 || ticks < rq->agedue)
+    return;
+
+  for(int q = 1; q < NQUEUE; q++){
+    while((p = rq->head[q]) != 0 && ticks - p->enter > AGE){
+      rq_remove(rq, p);
+      p->curr_ticks = 0;
+      p->wtime = 0;
+      p->tstamp = ticks;
+      p->curr_queue = q-1;  // shift from q queue to q-1 queue
+      rq_push(rq, p);
+    }
   }
+
+  // Only after all promotions: a process promoted into a level
+  // already scanned above may now be its head.
+  due = ~0;
+  for(int q = 1; q < NQUEUE; q++)
+    if((p = rq->head[q]) != 0 && p->enter + AGE + 1 < due)
+      due = p->enter + AGE + 1;
+  rq->agedue = due;
 }
+#endif
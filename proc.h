@@ -8,6 +8,7 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  volatile int tickless;       // Halted with the periodic timer stopped
 };
 
 extern struct cpu cpus[NCPU];
@@ -32,6 +33,20 @@ struct context {
   uint eip;
 };
 
+// A memory mapping made by mmap(), or a program segment
+// recorded by exec().
+struct vma {
+  uint addr;                   // Page-aligned start
+  uint len;                    // Bytes, page multiple; 0 if slot unused
+  int prot;                    // PROT_READ, PROT_WRITE
+  int flags;                   // MAP_SHARED or MAP_PRIVATE, MAP_ANON, VMA_EXEC
+  struct inode *ip;            // Mapped file, 0 if anonymous
+  uint off;                    // Offset in ip of addr
+  uint filesz;                 // Bytes from ip; the rest is zero
+};
+
+#define VMA_EXEC 0x100         // Program segment, below p->sz
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -47,21 +62,29 @@ struct proc {
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
+  struct vma vma[NVMA];        // Memory mappings
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
 
   int ctime;                   // Process creation time
   int etime;                   // Process end time
   int rtime;                   // Process total time / runtime
-  int wtime;                   // resets to 0 if new queue alloted
+  int wtime;                   // time RUNNABLE, resets to 0 if new queue alloted
+  uint tstamp;                 // ticks at last RUNNABLE/RUNNING transition
 
   int priority;                // Process priority
 
   int n_run;                   // no of time proc is executed (picked by scheduler)
+  int nsyscall;                // no of system calls made
   int ticks[5];                // no of ticks the process ran in each of 5 queues
   int curr_queue;              // process present in which queue
   int curr_ticks;              // ticks proc ran in the queue (used in time slicing)
   int enter;                   // Used in aging
+  struct proc *qnext;          // Next proc in run queue
+  struct proc *qprev;          // Previous proc in run queue
+  struct runq *rq;             // Run queue this proc is linked into, or 0
+  int qlevel;                  // Level of rq this proc is linked into
+  int cpu;                     // CPU this proc last ran on
   int change_q;                // Flag to check to change queue
 };
 
@@ -70,6 +93,7 @@ struct proc {
 //   original data and bss
 //   fixed-size stack
 //   expandable heap
+//   ...
+//   mmap() regions, down from KERNBASE
 
-void change_time(void);
 int checkPreempt(int, int);
\ No newline at end of file
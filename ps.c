@@ -9,7 +9,7 @@ int main(int argc, char *argv[])
         printf(1,"Usage: ps\n");
     else
     {
-        printf(1,"PID Priority   State   r_time w_time  n_run  cur_q  | q0  q1  q2  q3  q4  q5  q6\n");
+        printf(1,"PID Priority   State   r_time w_time  n_run  cur_q  vsz(K)  rss(K)  | q0  q1  q2  q3  q4  q5  q6\n");
         
         printpinfos();  // prints all the information
     }
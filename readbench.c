@@ -0,0 +1,73 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+// Sequential file read throughput for several read sizes.
+// Usage: readbench [megabytes]
+// Build the kernel with BLOCKREAD=1 to compare against reading
+// a block at a time.
+
+#define MAXREAD 65536
+
+static char buf[MAXREAD];
+
+// Print n bytes in t ticks as MB/s with one decimal.
+static void
+rate(int n, int t)
+{
+  int kbs;
+
+  if (t == 0)
+    t = 1;
+  kbs = n / 1024 * 100 / t;  // 100 ticks a second
+  printf(1, "%d.%d MB/s", kbs / 1024, kbs % 1024 * 10 / 1024);
+}
+
+int main(int argc, char *argv[])
+{
+  static int sizes[] = { 512, 4096, MAXREAD };
+  int mb = 2;
+  int i, n, fd, tot, start, ticks;
+
+  if (argc > 1)
+    mb = atoi(argv[1]);
+
+  fd = open("readbench.tmp", O_CREATE | O_RDWR);
+  if (fd < 0)
+  {
+    printf(1, "readbench: cannot create readbench.tmp\n");
+    exit();
+  }
+  for (i = 0; i < MAXREAD; i++)
+    buf[i] = i;
+  for (tot = 0; tot < mb * 1024 * 1024; tot += MAXREAD)
+  {
+    if (write(fd, buf, MAXREAD) != MAXREAD)
+    {
+      printf(1, "readbench: write failed\n");
+      close(fd);
+      unlink("readbench.tmp");
+      exit();
+    }
+  }
+  close(fd);
+
+  for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    fd = open("readbench.tmp", O_RDONLY);
+    start = uptime();
+    tot = 0;
+    while ((n = read(fd, buf, sizes[i])) > 0)
+      tot += n;
+    ticks = uptime() - start;
+    close(fd);
+
+    printf(1, "%d MB in %d byte reads: %d ticks, ", mb, sizes[i], ticks);
+    rate(tot, ticks);
+    printf(1, "\n");
+  }
+
+  unlink("readbench.tmp");
+  exit();
+}
@@ -0,0 +1,110 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+// cat of a large file into a pipe read by a wc-like counter,
+// copying through user space as cat does, and with splice().
+// Usage: splicebench [megabytes]
+
+#define BUFSZ 4096
+
+static char buf[BUFSZ];
+
+// Print n bytes in t ticks as MB/s with one decimal.
+static void
+rate(int n, int t)
+{
+  int kbs;
+
+  if (t == 0)
+    t = 1;
+  kbs = n / 1024 * 100 / t;  // 100 ticks a second
+  printf(1, "%d.%d MB/s", kbs / 1024, kbs % 1024 * 10 / 1024);
+}
+
+// Send the file into a pipe with read+write of size bytes, or
+// with splice if size is 0; a child counts what comes out.
+static void
+run(int mb, int size)
+{
+  int fd, fds[2], n, pid, tot, start, ticks;
+
+  if ((fd = open("splicebench.tmp", O_RDONLY)) < 0 || pipe(fds) < 0)
+  {
+    printf(1, "splicebench: open or pipe failed\n");
+    exit();
+  }
+  start = uptime();
+  pid = fork();
+  if (pid < 0)
+  {
+    printf(1, "splicebench: fork failed\n");
+    exit();
+  }
+  if (pid == 0)
+  {
+    close(fds[1]);
+    tot = 0;
+    while ((n = read(fds[0], buf, BUFSZ)) > 0)
+      tot += n;
+    if (tot != mb * 1024 * 1024)
+      printf(1, "splicebench: counted %d bytes\n", tot);
+    exit();
+  }
+  close(fds[0]);
+  if (size == 0)
+  {
+    while (splice(fd, fds[1], 1024 * 1024) > 0)
+      ;
+  }
+  else
+  {
+    while ((n = read(fd, buf, size)) > 0)
+      write(fds[1], buf, n);
+  }
+  close(fds[1]);
+  close(fd);
+  wait();
+  ticks = uptime() - start;
+
+  if (size == 0)
+    printf(1, "%d MB with splice: %d ticks, ", mb, ticks);
+  else
+    printf(1, "%d MB with %d byte read+write: %d ticks, ", mb, size, ticks);
+  rate(mb * 1024 * 1024, ticks);
+  printf(1, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+  int mb = 4;
+  int fd, tot;
+
+  if (argc > 1)
+    mb = atoi(argv[1]);
+
+  if ((fd = open("splicebench.tmp", O_CREATE | O_RDWR)) < 0)
+  {
+    printf(1, "splicebench: cannot create splicebench.tmp\n");
+    exit();
+  }
+  for (tot = 0; tot < mb * 1024 * 1024; tot += BUFSZ)
+  {
+    if (write(fd, buf, BUFSZ) != BUFSZ)
+    {
+      printf(1, "splicebench: write failed\n");
+      close(fd);
+      unlink("splicebench.tmp");
+      exit();
+    }
+  }
+  close(fd);
+
+  run(mb, 512);  // cat's buffer size
+  run(mb, BUFSZ);
+  run(mb, 0);
+
+  unlink("splicebench.tmp");
+  exit();
+}
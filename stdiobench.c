@@ -0,0 +1,83 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+// System calls per line of ps-like printf output to the
+// console, a file and a pipe.
+// Usage: stdiobench [lines]
+// Build with UNBUFFERED=1 to compare against writing a
+// character at a time.
+
+static char buf[512];
+
+// Print lines to fd and return the system calls it took.
+static int
+run(int fd, int lines)
+{
+  int i, n;
+
+  n = syscount();
+  for (i = 0; i < lines; i++)
+    printf(fd, " %d\t%d\t%s\t%d\t%d\t%d\n", i, 60, "SLEEPING", i * 3, i * 7, i % 5);
+  fflush(fd);
+  return syscount() - n - 1;  // not counting syscount itself
+}
+
+static void
+report(char *what, int lines, int n)
+{
+  printf(1, "%s: %d lines, %d system calls, %d.%d per line\n",
+         what, lines, n, n / lines, n % lines * 10 / lines);
+}
+
+int main(int argc, char *argv[])
+{
+  int lines = 1000, console = 10;
+  int fd, fds[2], pid, n;
+
+  if (argc > 1)
+    lines = atoi(argv[1]);
+  if (lines < 1)
+    lines = 1;
+
+  n = run(1, console);
+  report("console", console, n);
+
+  fd = open("stdiobench.tmp", O_CREATE | O_RDWR);
+  if (fd < 0)
+  {
+    printf(1, "stdiobench: cannot create stdiobench.tmp\n");
+    exit();
+  }
+  n = run(fd, lines);
+  close(fd);
+  unlink("stdiobench.tmp");
+  report("file", lines, n);
+
+  if (pipe(fds) < 0)
+  {
+    printf(1, "stdiobench: pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if (pid < 0)
+  {
+    printf(1, "stdiobench: fork failed\n");
+    exit();
+  }
+  if (pid == 0)
+  {
+    close(fds[1]);
+    while (read(fds[0], buf, sizeof(buf)) > 0)
+      ;
+    exit();
+  }
+  close(fds[0]);
+  n = run(fds[1], lines);
+  close(fds[1]);
+  wait();
+  report("pipe", lines, n);
+
+  exit();
+}
@@ -23,3 +23,8 @@
 #define SYS_waitx  22
 #define SYS_set_priority  23
 #define SYS_printpinfos  24
+#define SYS_printkstats  25
+#define SYS_mmap  26
+#define SYS_munmap  27
+#define SYS_splice  28
+#define SYS_syscount  29
@@ -85,7 +85,7 @@ sys_write(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argrptr(1, &p, n) < 0)
     return -1;
   return filewrite(f, p, n);
 }
@@ -218,6 +218,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcacheremove(dp->dev, dp->inum, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -327,6 +328,7 @@ sys_open(void)
   f->type = FD_INODE;
   f->ip = ip;
   f->off = 0;
+  f->raoff = f->rawin = f->ranext = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
   return fd;
@@ -442,3 +444,52 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+// Map a file or anonymous memory; addr is only a hint and is
+// ignored.  Returns the address, or -1.
+int
+sys_mmap(void)
+{
+  struct file *f;
+  int len, prot, flags, off, share;
+
+  if(argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(len <= 0 || off < 0 || off % PGSIZE)
+    return -1;
+  share = flags & (MAP_SHARED|MAP_PRIVATE);
+  if(share != MAP_SHARED && share != MAP_PRIVATE)
+    return -1;
+  f = 0;
+  if((flags & MAP_ANON) == 0){
+    if(argfd(4, 0, &f) < 0 || f->type != FD_INODE || !f->readable)
+      return -1;
+    if(share == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+  return mmap(len, prot, flags, f ? f->ip : 0, off);
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || len <= 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+// Move up to n bytes from fd in to fd out without copying them
+// through user space.  Returns the bytes moved, 0 at the end of in.
+int
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
@@ -71,6 +71,8 @@ sys_sleep(void)
       release(&tickslock);
       return -1;
     }
+    if(ticks0 + n < tickdeadline)
+      tickdeadline = ticks0 + n;
     sleep(&ticks, &tickslock);
   }
   release(&tickslock);
@@ -118,4 +120,24 @@ int
 sys_printpinfos(void)
 {
   return printpinfos();
-}
\ No newline at end of file
+}
+
+// print kernel performance counters to the console
+int
+sys_printkstats(void)
+{
+  kallocstats();
+  bcachestats();
+  logstats();
+  dcachestats();
+  icachestats();
+  pcachestats();
+  return 0;
+}
+
+// number of system calls the caller has made, this one included
+int
+sys_syscount(void)
+{
+  return myproc()->nsyscall;
+}
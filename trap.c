@@ -13,6 +13,7 @@ struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
 struct spinlock tickslock;
 uint ticks;
+uint tickdeadline = ~0;  // TICKLESS: earliest tick a sleep(n) caller waits for
 
 void
 tvinit(void)
@@ -32,6 +33,20 @@ idtinit(void)
   lidt(idt, sizeof(idt));
 }
 
+// Account for n ticks that passed while CPU0's
+// periodic timer was stopped.
+void
+tickcatchup(uint n)
+{
+  if(n == 0)
+    return;
+  acquire(&tickslock);
+  ticks += n;
+  tickdeadline = ~0;
+  wakeup(&ticks);
+  release(&tickslock);
+}
+
 //PAGEBREAK: 41
 void
 trap(struct trapframe *tf)
@@ -48,17 +63,21 @@ trap(struct trapframe *tf)
 
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
-    if(cpuid() == 0){
+    // While tickless, the idle loop does the accounting.
+    if(cpuid() == 0 && !mycpu()->tickless){
       acquire(&tickslock);
       ticks++;
-
-      change_time();
-
+      tickdeadline = ~0;  // sleepers we wake register again
       wakeup(&ticks);
       release(&tickslock);
     }
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_RESCHED:
+    // Nothing to do: the halted scheduler loop rechecks
+    // the run queues once this returns.
+    lapiceoi();
+    break;
   case T_IRQ0 + IRQ_IDE:
     ideintr();
     lapiceoi();
@@ -81,6 +100,16 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    if(myproc() && pagefault(myproc()->pgdir, rcr2(), tf->err) == 0){
+      // A kernel access to user memory, e.g. copying out a
+      // read(); go straight back to it.
+      if((tf->cs&3) == 0)
+        return;
+      break;
+    }
+    // fall through
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -120,15 +149,12 @@ trap(struct trapframe *tf)
     {
       if (tf->trapno == T_IRQ0 + IRQ_TIMER)
       {
-        if(myproc()->curr_ticks >= q_ticks_max[myproc()->curr_queue])
+        if(slice_ticks(myproc()) >= q_ticks_max[myproc()->curr_queue])
         {
           change_q_flag(myproc());
           yield();
         }
       }
-
-      else 		
-        incr_curr_ticks(myproc());
     }
   #else
     // Force process to give up CPU on clock tick.
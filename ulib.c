@@ -104,3 +104,50 @@ memmove(void *vdst, const void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// Set by printf.c once it buffers output.  Writes out the
+// output buffered for fd, or for every fd if fd is -1, and
+// forgets the buffer if the fd is being closed.
+void (*ioflush)(int fd, int closing);
+
+int
+fork(void)
+{
+  if(ioflush)
+    ioflush(-1, 0);
+  return _fork();
+}
+
+int
+exit(void)
+{
+  if(ioflush)
+    ioflush(-1, 0);
+  _exit();
+}
+
+int
+exec(char *path, char **argv)
+{
+  if(ioflush)
+    ioflush(-1, 0);
+  return _exec(path, argv);
+}
+
+// So that output written directly follows what printf()
+// buffered before it.
+int
+write(int fd, const void *p, int n)
+{
+  if(ioflush && fd >= 0)
+    ioflush(fd, 0);
+  return _write(fd, p, n);
+}
+
+int
+close(int fd)
+{
+  if(ioflush)
+    ioflush(fd, 1);
+  return _close(fd);
+}
@@ -4,7 +4,22 @@
 #include "param.h"
 
 // Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// The C programming Language, 2nd ed.  Section 8.7,
+// with size-class slabs in front of it for small objects.
+//
+// A block of up to MAXSMALL units (header included) is rounded
+// up to one of NCLASS power-of-two sizes and taken from that
+// class's free list, so malloc() and free() of small objects
+// take constant time and never walk or fragment the K&R list.
+// A class whose list is empty carves its next block from its
+// current slab, a SLABUNITS block from the K&R list, one block
+// at a time, so untouched parts of a slab cost no memory with
+// lazy sbrk.  Small blocks are never returned to the K&R list.
+// A small block's header holds SMALL|class in s.size, which no
+// K&R block size can equal, and links it on its free list
+// through s.ptr.  Larger blocks use the K&R address-ordered
+// list, which coalesces adjacent free blocks.
+// Build with KRMALLOC=1 to use the K&R list for everything.
 
 typedef long Align;
 
@@ -18,15 +33,27 @@ union header {
 
 typedef union header Header;
 
+#define NCLASS    7           // 2, 4, ..., 128 units
+#define MAXSMALL  128         // units in the largest class
+#define SLABUNITS 2048        // 16 KB
+#define SMALL     0x80000000  // in s.size of a small block
+
 static Header base;
 static Header *freep;
 
-void
-free(void *ap)
+#ifndef KRMALLOC
+static struct {
+  Header *free;               // free blocks of this class
+  Header *next;               // rest of the current slab
+  Header *end;
+} class[NCLASS];
+#endif
+
+static void
+krfree(Header *bp)
 {
-  Header *bp, *p;
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -56,17 +83,16 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  krfree(hp);
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+// Take a block of nunits units from the K&R list.
+static Header*
+kralloc(uint nunits)
 {
   Header *p, *prevp;
-  uint nunits;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
     base.s.size = 0;
@@ -81,10 +107,74 @@ malloc(uint nbytes)
         p->s.size = nunits;
       }
       freep = prevp;
-      return (void*)(p + 1);
+      return p;
     }
     if(p == freep)
       if((p = morecore(nunits)) == 0)
         return 0;
   }
 }
+
+#ifndef KRMALLOC
+// Take a block of class c.
+static Header*
+slaballoc(int c)
+{
+  Header *p;
+  uint units;
+
+  units = 2 << c;
+  if((p = class[c].free) != 0){
+    class[c].free = p->s.ptr;
+  } else {
+    if(class[c].next + units > class[c].end){
+      if((p = kralloc(SLABUNITS)) == 0)
+        return 0;
+      class[c].next = p;
+      class[c].end = p + SLABUNITS;
+    }
+    p = class[c].next;
+    class[c].next += units;
+  }
+  p->s.size = SMALL | c;
+  return p;
+}
+#endif
+
+void
+free(void *ap)
+{
+  Header *bp;
+
+  bp = (Header*)ap - 1;
+#ifndef KRMALLOC
+  if(bp->s.size & SMALL){
+    int c = bp->s.size & ~SMALL;
+    bp->s.ptr = class[c].free;
+    class[c].free = bp;
+    return;
+  }
+#endif
+  krfree(bp);
+}
+
+void*
+malloc(uint nbytes)
+{
+  Header *p;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+#ifndef KRMALLOC
+  if(nunits <= MAXSMALL){
+    int c;
+    for(c = 0; (2 << c) < nunits; c++)
+      ;
+    p = slaballoc(c);
+  } else
+#endif
+    p = kralloc(nunits);
+  if(p == 0)
+    return 0;
+  return (void*)(p + 1);
+}
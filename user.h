@@ -27,6 +27,16 @@ int uptime(void);
 int waitx(int*, int*);
 int set_priority(int, int);
 int printpinfos(void);
+int printkstats(void);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int splice(int, int, int);
+int syscount(void);
+int _fork(void);
+int _exit(void) __attribute__((noreturn));
+int _exec(char*, char**);
+int _close(int);
+int _write(int, const void*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -34,10 +44,15 @@ char* strcpy(char*, const char*);
 void *memmove(void*, const void*, int);
 char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
-void printf(int, const char*, ...);
 char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+extern void (*ioflush)(int, int);
+
+// printf.c
+void printf(int, const char*, ...);
+int fwrite(int, const void*, int);
+void fflush(int);
@@ -1737,6 +1737,281 @@ void argptest()
   printf(1, "arg test passed\n");
 }
 
+// mmap of anonymous memory and files, private and shared,
+// across fork and munmap.
+void
+mmaptest(void)
+{
+  char *p;
+  int fd, i, pid;
+
+  printf(stdout, "mmap test\n");
+
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "mmap: create failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i % 26;
+  if(write(fd, buf, sizeof(buf)) != sizeof(buf) || write(fd, buf, 100) != 100){
+    printf(stdout, "mmap: write failed\n");
+    exit();
+  }
+  close(fd);
+
+  // Private read-only file mapping, zero past the end.
+  fd = open("mmapfile", O_RDONLY);
+  p = mmap(0, 3*4096, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf(stdout, "mmap: private mmap failed\n");
+    exit();
+  }
+  for(i = 0; i < 3*4096; i++){
+    if(p[i] != (i < sizeof(buf) + 100 ? 'a' + i % sizeof(buf) % 26 : 0)){
+      printf(stdout, "mmap: byte %d is %d\n", i, p[i]);
+      exit();
+    }
+  }
+  if(read(fd, p, 10) != -1){
+    printf(stdout, "mmap: read into read-only mapping\n");
+    exit();
+  }
+  if(munmap(p, 3*4096) < 0){
+    printf(stdout, "mmap: munmap failed\n");
+    exit();
+  }
+  close(fd);
+
+  // Shared file mapping is written back by munmap.
+  fd = open("mmapfile", O_RDWR);
+  p = mmap(0, 3*4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf(stdout, "mmap: shared mmap failed\n");
+    exit();
+  }
+  close(fd);
+  p[0] = 'Z';
+  p[sizeof(buf)] = 'Y';
+  p[2*4096 + 2000] = 'X';  // past the end of the file
+  munmap(p, 3*4096);
+  fd = open("mmapfile", O_RDONLY);
+  if(read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != 'Z' ||
+     read(fd, buf, sizeof(buf)) != 100 || buf[0] != 'Y'){
+    printf(stdout, "mmap: shared write not in file\n");
+    exit();
+  }
+  close(fd);
+  unlink("mmapfile");
+
+  // Anonymous memory: shared is seen by the parent, private isn't.
+  p = mmap(0, 2*4096, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON, -1, 0);
+  if(p == (char*)-1){
+    printf(stdout, "mmap: anonymous mmap failed\n");
+    exit();
+  }
+  p[4096] = 1;
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "mmap: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    p[0] = 2;
+    p[4096] = 3;
+    exit();
+  }
+  wait();
+  if(p[0] != 2 || p[4096] != 3){
+    printf(stdout, "mmap: shared anonymous page not shared\n");
+    exit();
+  }
+  munmap(p, 2*4096);
+
+  p = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+  p[0] = 1;
+  pid = fork();
+  if(pid == 0){
+    p[0] = 2;
+    exit();
+  }
+  wait();
+  if(p[0] != 1){
+    printf(stdout, "mmap: private anonymous page shared\n");
+    exit();
+  }
+  munmap(p, 4096);
+
+  printf(stdout, "mmap test ok\n");
+}
+
+// splice from a file into a pipe and from a pipe into a file.
+void
+splicetest(void)
+{
+  int fd, fds[2], i, n, pid, tot;
+
+  printf(stdout, "splice test\n");
+
+  fd = open("splicefile", O_CREATE|O_RDWR);
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = i % 251;
+  for(i = 0; i < 5; i++)
+    write(fd, buf, sizeof(buf));
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf(stdout, "splice: pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    close(fds[0]);
+    fd = open("splicefile", O_RDONLY);
+    if(splice(fd, fds[1], 5*sizeof(buf) + 100) != 5*sizeof(buf) ||
+       splice(fd, fds[1], 100) != 0){
+      printf(stdout, "splice: file to pipe failed\n");
+      exit();
+    }
+    exit();
+  }
+  close(fds[1]);
+  fd = open("splicecopy", O_CREATE|O_RDWR);
+  if(splice(fds[0], fd, 5*sizeof(buf) + 100) != 5*sizeof(buf)){
+    printf(stdout, "splice: pipe to file failed\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fd);
+  wait();
+
+  fd = open("splicecopy", O_RDONLY);
+  tot = 0;
+  while((n = read(fd, buf, sizeof(buf))) > 0){
+    for(i = 0; i < n; i++){
+      if(buf[i] != (char)((tot + i) % sizeof(buf) % 251)){
+        printf(stdout, "splice: wrong byte at %d\n", tot + i);
+        exit();
+      }
+    }
+    tot += n;
+  }
+  close(fd);
+  if(tot != 5*sizeof(buf)){
+    printf(stdout, "splice: copied %d bytes\n", tot);
+    exit();
+  }
+  unlink("splicefile");
+  unlink("splicecopy");
+  printf(stdout, "splice test ok\n");
+}
+
+// splice a file into a pipe that another process is filling
+// with write() at the same time.
+void
+splicesharedtest(void)
+{
+  int fd, fds[2], i, n, pid1, pid2, tot;
+
+  printf(stdout, "splice shared pipe test\n");
+
+  fd = open("splicefile", O_CREATE|O_RDWR);
+  for(i = 0; i < 16; i++)
+    write(fd, buf, sizeof(buf));
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf(stdout, "splice shared: pipe failed\n");
+    exit();
+  }
+  pid1 = fork();
+  if(pid1 == 0){
+    close(fds[0]);
+    fd = open("splicefile", O_RDONLY);
+    tot = 0;
+    while((n = splice(fd, fds[1], sizeof(buf))) > 0)
+      tot += n;
+    if(tot != 16*sizeof(buf))
+      printf(stdout, "splice shared: spliced %d bytes\n", tot);
+    exit();
+  }
+  pid2 = fork();
+  if(pid2 == 0){
+    close(fds[0]);
+    for(i = 0; i < 16; i++)
+      write(fds[1], buf, sizeof(buf));
+    exit();
+  }
+  if(pid1 < 0 || pid2 < 0){
+    printf(stdout, "splice shared: fork failed\n");
+    exit();
+  }
+  close(fds[1]);
+  tot = 0;
+  while((n = read(fds[0], buf, sizeof(buf))) > 0)
+    tot += n;
+  close(fds[0]);
+  wait();
+  wait();
+  unlink("splicefile");
+  if(tot != 32*sizeof(buf)){
+    printf(stdout, "splice shared: read %d bytes\n", tot);
+    exit();
+  }
+  printf(stdout, "splice shared pipe test ok\n");
+}
+
+// printf to a file is buffered, written out by close, not
+// written twice by a fork, and not overtaken by a write.
+void
+stdiotest(void)
+{
+  char out[32];
+  int fd, n, pid;
+
+  printf(stdout, "stdio test\n");
+
+  fd = open("stdiofile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "stdio: create failed\n");
+    exit();
+  }
+  printf(fd, "abc");
+  n = syscount();
+  printf(fd, "%d%s", 12345, "6789");
+  if(syscount() - n != 1){
+    printf(stdout, "stdio: printf made %d system calls\n", syscount() - n - 1);
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "stdio: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    printf(fd, "d");
+    exit();
+  }
+  wait();
+  printf(fd, "e");
+  write(fd, "f", 1);
+  printf(fd, "\n");
+  close(fd);
+
+  fd = open("stdiofile", O_RDONLY);
+  n = read(fd, out, sizeof(out) - 1);
+  close(fd);
+  if(n < 0)
+    n = 0;
+  out[n] = 0;
+  if(strcmp(out, "abc123456789def\n") != 0){
+    printf(stdout, "stdio: file holds %s\n", out);
+    exit();
+  }
+  unlink("stdiofile");
+  printf(stdout, "stdio test ok\n");
+}
+
 unsigned long randstate = 1;
 unsigned int
 rand()
@@ -1769,6 +2044,7 @@ main(int argc, char *argv[])
   bsstest();
   sbrktest();
   validatetest();
+  mmaptest();
 
   opentest();
   writetest();
@@ -1781,6 +2057,9 @@ main(int argc, char *argv[])
 
   mem();
   pipe1();
+  splicetest();
+  splicesharedtest();
+  stdiotest();
   preempt();
   exitwait();
 
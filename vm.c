@@ -6,6 +6,11 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
@@ -206,6 +211,8 @@ loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
     if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
       panic("loaduvm: address should exist");
     pa = PTE_ADDR(*pte);
+    if(i % (NREADAHEAD*BSIZE) == 0)
+      iprefetch(ip, (offset+i)/BSIZE, NREADAHEAD + PGSIZE/BSIZE);
     if(sz - i < PGSIZE)
       n = sz - i;
     else
@@ -323,10 +330,9 @@ copyuvm(pde_t *pgdir, uint sz)
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    // Heap pages not touched yet stay lazy in the child.
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0 || !(*pte & PTE_P))
+      continue;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
     if((mem = kalloc()) == 0)
@@ -344,6 +350,483 @@ bad:
   return 0;
 }
 
+// Given a parent process's page table, create a copy-on-write
+// copy of it for a child: writable pages are shared read-only
+// and marked PTE_COW in both, and copied on the first write
+// (see pagefault).
+pde_t*
+cowuvm(pde_t *pgdir, uint sz)
+{
+  pde_t *d;
+  pte_t *pte;
+  uint pa, i, flags;
+
+  if((d = setupkvm()) == 0)
+    return 0;
+  for(i = 0; i < sz; i += PGSIZE){
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0 || !(*pte & PTE_P))
+      continue;
+    if(*pte & PTE_W){
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+      invlpg((void*)i);
+    }
+    pa = PTE_ADDR(*pte);
+    flags = PTE_FLAGS(*pte);
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
+      goto bad;
+    kincref(P2V(pa));
+  }
+  return d;
+
+bad:
+  freevm(d);
+  return 0;
+}
+
+// Give pgdir a private, writable copy of the copy-on-write
+// page at va.  Returns 0 on success, -1 if va is not such
+// a page or memory ran out.
+static int
+cowcopy(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa;
+  char *mem;
+
+  if(va >= KERNBASE || (pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE_ADDR(*pte);
+  if(krefcount(P2V(pa)) > 1){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, (char*)P2V(pa), PGSIZE);
+    *pte = V2P(mem) | PTE_FLAGS(*pte);
+    kfree(P2V(pa));
+  }
+  // Last reference: the page can simply become writable.
+  *pte = (*pte | PTE_W) & ~PTE_COW;
+  invlpg((void*)PGROUNDDOWN(va));
+  return 0;
+}
+
+static int vmafault(struct proc*, uint, int);
+static struct vma* vmafind(struct proc*, uint);
+
+// Give the current process a zeroed page at va, a heap address
+// below p->sz that sbrk() reserved but nothing has touched.
+// Returns 0, or -1 if out of memory.
+static int
+heapfault(pde_t *pgdir, uint va)
+{
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(pgdir, (char*)PGROUNDDOWN(va), PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Fill in p's missing page at va: from the program file or a
+// mapping if one covers it, else zeroed if it is in the heap.
+static int
+pagein(struct proc *p, uint va, int write)
+{
+  if(vmafind(p, va))
+    return vmafault(p, va, write);
+  if(va < p->sz)
+    return heapfault(p->pgdir, va);
+  return -1;
+}
+
+// Handle a page fault at va in the current process's page
+// table pgdir with error code err.  Returns 0 if the fault
+// was resolved and the access can be retried, -1 if not.
+int
+pagefault(pde_t *pgdir, uint va, uint err)
+{
+  if((err & (FEC_PR|FEC_WR)) == (FEC_PR|FEC_WR))
+    return cowcopy(pgdir, va);
+  if((err & FEC_PR) == 0 && myproc()->pgdir == pgdir)
+    return pagein(myproc(), va, err & FEC_WR);
+  return -1;
+}
+
+// Number of pages of user memory present in pgdir.  May be
+// called on another process's page table, which exec() could be
+// freeing, so it only trusts physical addresses below PHYSTOP.
+int
+uvmresident(pde_t *pgdir)
+{
+  pte_t *pgtab;
+  int i, j, n;
+
+  n = 0;
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if((pgdir[i] & PTE_P) == 0 || PTE_ADDR(pgdir[i]) >= PHYSTOP)
+      continue;
+    pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
+    for(j = 0; j < NPTENTRIES; j++)
+      if(pgtab[j] & PTE_P)
+        n++;
+  }
+  return n;
+}
+
+// Bytes of address space p has: its image and heap, and its mappings.
+uint
+uvmsize(struct proc *p)
+{
+  struct vma *v;
+  uint sz;
+
+  sz = p->sz;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if((v->flags & VMA_EXEC) == 0)
+      sz += v->len;
+  return sz;
+}
+
+//PAGEBREAK!
+// Memory mappings.  mmap() places each mapping just below the
+// ones before it, down from KERNBASE, and only records it;
+// vmafault() fills a page in on first touch, reading file
+// mappings through the buffer cache.  Pages of a shared mapping
+// stay shared across fork, and dirty ones are written back to
+// the file by munmap(), exit and exec.  Processes that map a
+// file separately each have their own copy of its pages.
+//
+// exec() records the program's segments the same way, as
+// private VMA_EXEC mappings below p->sz, so each text and data
+// page is read from the program file when first used.
+
+// Return p's mapping containing va, or 0.
+static struct vma*
+vmafind(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len > 0 && va >= v->addr && va - v->addr < v->len)
+      return v;
+  return 0;
+}
+
+// Drop mapping v's inode and free its slot.
+static void
+vmafree(struct vma *v)
+{
+  if(v->ip){
+    begin_op();
+    iput(v->ip);
+    end_op();
+  }
+  v->ip = 0;
+  v->len = 0;
+}
+
+// Lowest address of p's mappings, which the heap must stay below.
+uint
+vmabase(struct proc *p)
+{
+  struct vma *v;
+  uint base;
+
+  base = KERNBASE;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len > 0 && (v->flags & VMA_EXEC) == 0 && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// Map len bytes of ip from offset off, or zeroed memory if ip is
+// 0, into the current process.  Returns the address, or -1.
+int
+mmap(uint len, int prot, int flags, struct inode *ip, uint off)
+{
+  struct proc *curproc = myproc();
+  struct vma *v, *nv;
+  uint start, end;
+
+  len = PGROUNDUP(len);
+  for(nv = curproc->vma; nv < &curproc->vma[NVMA]; nv++)
+    if(nv->len == 0)
+      break;
+  if(len == 0 || nv == &curproc->vma[NVMA])
+    return -1;
+
+  // Highest free range below the other mappings and above the heap.
+  for(end = KERNBASE; ; end = v->addr){
+    if(end < len || end - len < PGROUNDUP(curproc->sz))
+      return -1;
+    start = end - len;
+    for(v = curproc->vma; v < &curproc->vma[NVMA]; v++)
+      if(v->len > 0 && v->addr < end && start < v->addr + v->len)
+        break;
+    if(v == &curproc->vma[NVMA])
+      break;
+  }
+
+  nv->addr = start;
+  nv->len = len;
+  nv->prot = prot;
+  nv->flags = flags;
+  nv->ip = ip ? idup(ip) : 0;
+  nv->off = off;
+  nv->filesz = len;
+  return start;
+}
+
+// Give p a page for va in one of its mappings, zeroed or read
+// from the mapped file, or shared from the pcache for program
+// text.  Returns 0, or -1 if va is not mapped,
+// the mapping does not allow the access, or memory ran out.
+static int
+vmafault(struct proc *p, uint va, int write)
+{
+  struct vma *v;
+  char *mem;
+  uint a, n;
+  int perm;
+
+  if((v = vmafind(p, va)) == 0)
+    return -1;
+  if((v->prot & (write ? PROT_WRITE : PROT_READ|PROT_WRITE)) == 0)
+    return -1;
+  a = PGROUNDDOWN(va);
+  perm = PTE_U;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  n = 0;
+  if(v->ip && a - v->addr < v->filesz){
+    n = v->filesz - (a - v->addr);
+    if(n > PGSIZE)
+      n = PGSIZE;
+  }
+
+  if((v->flags & VMA_EXEC) && n == PGSIZE && !write){
+    // A whole page of the program: share the cached copy,
+    // copy-on-write if the segment is writable.
+    ilock(v->ip);
+    mem = pcacheget(v->ip, v->off + (a - v->addr));
+    iunlock(v->ip);
+    if(mem == 0)
+      return -1;
+    if(perm & PTE_W)
+      perm = (perm & ~PTE_W) | PTE_COW;
+  } else {
+    if((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    if(n > 0){
+      // Short past the end of the file; the rest stays zero.
+      // Start reading the next page too, for sequential faults.
+      ilock(v->ip);
+      if(n == PGSIZE)
+        iprefetch(v->ip, (v->off + (a - v->addr)) / BSIZE, 2*PGSIZE/BSIZE);
+      readi(v->ip, mem, v->off + (a - v->addr), n);
+      iunlock(v->ip);
+    }
+  }
+  if(mappages(p->pgdir, (char*)a, PGSIZE, V2P(mem), perm) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Check that [va, va+n) lies in p's heap or in one of its
+// mappings and allows the access, and fill in its pages now, so
+// that a system call can copy to or from it without faulting,
+// e.g. holding a lock, or running out of memory halfway.  For a
+// write, also copy the copy-on-write pages, since a fault from
+// the kernel that cannot get a page would panic.
+// Returns 0, or -1 if not.
+int
+uvmtouch(struct proc *p, uint va, uint n, int write)
+{
+  struct vma *v;
+  pte_t *pte;
+  uint a;
+
+  if(va >= p->sz || n > p->sz - va){
+    if((v = vmafind(p, va)) == 0 || n > v->addr + v->len - va)
+      return -1;
+    if(write && (v->prot & PROT_WRITE) == 0)
+      return -1;
+  }
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte && (*pte & PTE_P)){
+      if(write && (*pte & PTE_COW) && cowcopy(p->pgdir, a) < 0)
+        return -1;
+      continue;
+    }
+    if(pagein(p, a, write) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Write the dirty pages in [start, end) of p's mapping v back to
+// its file, if it is a shared file mapping.
+static void
+vmasync(struct proc *p, struct vma *v, uint start, uint end)
+{
+  pte_t *pte;
+  uint a, off, size;
+
+  if(v->ip == 0 || (v->flags & MAP_SHARED) == 0 || (v->prot & PROT_WRITE) == 0)
+    return;
+  for(a = start; a < end; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte == 0 || (*pte & (PTE_P|PTE_D)) != (PTE_P|PTE_D))
+      continue;
+    // Don't grow the file with the zeroes past its end.
+    off = v->off + (a - v->addr);
+    ilock(v->ip);
+    size = v->ip->size;
+    iunlock(v->ip);
+    if(off < size)
+      iwrite(v->ip, P2V(PTE_ADDR(*pte)), &off, size - off < PGSIZE ? size - off : PGSIZE);
+  }
+}
+
+// Unmap the pages of the current process in [va, va+len),
+// writing back those of shared file mappings.  Returns 0, or
+// -1 if va is not page-aligned or splitting a mapping in two
+// would need more than NVMA.
+int
+munmap(uint va, uint len)
+{
+  struct proc *curproc = myproc();
+  struct vma *v, *nv;
+  uint end, s, e;
+
+  end = va + PGROUNDUP(len);
+  if(va % PGSIZE || end < va)
+    return -1;
+
+  // Unmapping the middle of a mapping leaves two.
+  for(nv = curproc->vma; nv < &curproc->vma[NVMA]; nv++)
+    if(nv->len == 0)
+      break;
+  for(v = curproc->vma; v < &curproc->vma[NVMA]; v++)
+    if(v->len > 0 && (v->flags & VMA_EXEC) == 0 && va > v->addr &&
+       end < v->addr + v->len && nv == &curproc->vma[NVMA])
+      return -1;
+
+  for(v = curproc->vma; v < &curproc->vma[NVMA]; v++){
+    if(v->len == 0 || (v->flags & VMA_EXEC))
+      continue;
+    if(end <= v->addr || va >= v->addr + v->len)
+      continue;
+    s = va > v->addr ? va : v->addr;
+    e = end < v->addr + v->len ? end : v->addr + v->len;
+    vmasync(curproc, v, s, e);
+    deallocuvm(curproc->pgdir, e, s);
+    if(s == v->addr && e == v->addr + v->len){
+      vmafree(v);
+    } else if(s == v->addr){
+      v->off += e - v->addr;
+      v->filesz -= e - v->addr;
+      v->len -= e - v->addr;
+      v->addr = e;
+    } else {
+      if(e < v->addr + v->len){
+        *nv = *v;
+        nv->off += e - v->addr;
+        nv->filesz -= e - v->addr;
+        nv->len -= e - v->addr;
+        nv->addr = e;
+        if(nv->ip)
+          idup(nv->ip);
+      }
+      v->len = s - v->addr;
+      v->filesz = v->len;
+    }
+  }
+  lcr3(V2P(curproc->pgdir));  // flush the unmapped pages from the TLB
+  return 0;
+}
+
+// Map the pages of p's mapping v into np, copy-on-write if
+// it is private.  Returns 0, or -1 if memory ran out.
+static int
+vmashare(struct proc *np, struct proc *p, struct vma *v)
+{
+  pte_t *pte;
+  uint a, pa;
+
+  for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte == 0 || (*pte & PTE_P) == 0){
+      if((v->flags & MAP_SHARED) == 0 || (v->prot & (PROT_READ|PROT_WRITE)) == 0)
+        continue;
+      if(vmafault(p, a, 0) < 0)
+        return -1;
+      pte = walkpgdir(p->pgdir, (char*)a, 0);
+    }
+    if((v->flags & MAP_SHARED) == 0 && (*pte & PTE_W)){
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+      invlpg((void*)a);
+    }
+    pa = PTE_ADDR(*pte);
+    if(mappages(np->pgdir, (char*)a, PGSIZE, pa, PTE_FLAGS(*pte)) < 0)
+      return -1;
+    kincref(P2V(pa));
+  }
+  return 0;
+}
+
+// Give the new process np p's mappings.  Pages of private
+// mappings are shared copy-on-write; shared mappings are filled
+// in and the same pages mapped in both.  The program's segments
+// are below p->sz, so fork() has already copied their pages.
+// Returns 0, or -1 if memory ran out.
+int
+vmacopy(struct proc *np, struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    if((v->flags & VMA_EXEC) == 0 && vmashare(np, p, v) < 0)
+      goto bad;
+    np->vma[v - p->vma] = *v;
+    if(v->ip)
+      idup(v->ip);
+  }
+  return 0;
+
+bad:
+  for(v = np->vma; v < &np->vma[NVMA]; v++)
+    if(v->len > 0)
+      vmafree(v);
+  return -1;
+}
+
+// Drop all of p's mappings, writing back shared file pages.
+// The pages themselves go with p's page table.
+void
+vmaclear(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    vmasync(p, v, v->addr, v->addr + v->len);
+    vmafree(v);
+  }
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -367,10 +850,14 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte && (*pte & PTE_COW) && cowcopy(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;